@@ -1,17 +1,19 @@
 #include "AliParser.hh"
 
-AliParser::AliParser(string fileName,bool loadIndex) : sam(false),
-						       bam(false),
-						       stdin(false),
-						       file(NULL),
-						       index(NULL),
-						       record(NULL),
-						       fin(NULL),
-						       samin(NULL),
-						       cnames_(NULL),
-						       clens_(NULL),
-						       n_chr_(0),
-						       flag_(0)
+AliParser::AliParser(string fileName,bool loadIndex,int nThreads) : sam(false),
+								    bam(false),
+								    stdin(false),
+								    file(NULL),
+								    index(NULL),
+								    iter(NULL),
+								    record(NULL),
+								    fin(NULL),
+								    samin(NULL),
+								    cnames_(NULL),
+								    clens_(NULL),
+								    n_chr_(0),
+								    core_only_(false),
+								    flag_(0)
 {
   int len = fileName.length();
   if (len == 0) {
@@ -27,6 +29,7 @@ AliParser::AliParser(string fileName,bool loadIndex) : sam(false),
       } else {
 	bam = true;
 	record = new bam1_t();
+	setNumThreads(nThreads);
       }
     }
     if (loadIndex) {
@@ -73,6 +76,7 @@ AliParser::~AliParser()
   if (samin)   delete samin;
   if (file)    samclose(file);
   if (record)  delete record;
+  if (iter)    bam_iter_destroy(iter);
   if (index)   bam_index_destroy(index);
   if (cnames_) delete[] cnames_;
   if (clens_)  delete[] clens_;
@@ -82,12 +86,22 @@ bool AliParser::parseRecord()
 {
   chr_index_ = -1;
   if (bam || (sam && !samin)) {
-    if (samread(file,record) < 0) return false;
-    flag_ = record->core.flag;
     bam1_core_t &core = record->core;
+    uint32_t end;
+    if (core_only_) {
+      if (iter) {
+	if (bam_iter_read_core(file->x.bam,iter,&core,&end) < 0) return false;
+      } else if (bam_read1_core(file->x.bam,&core,&end) < 0) return false;
+    } else {
+      if (iter) {
+	if (bam_iter_read(file->x.bam,iter,record) < 0) return false;
+      } else if (samread(file,record) < 0) return false;
+      end = bam_calend(&core,bam1_cigar(record));
+    }
+    flag_ = core.flag;
     chr_index_ = core.tid;
     start_     = core.pos + 1;
-    end_       = bam_calend(&core,bam1_cigar(record));
+    end_       = end;
     qual_      = core.qual;
     read_len_  = core.l_qseq;
     frg_len_   = core.isize;
@@ -199,3 +213,36 @@ int AliParser::scrollTo(string chr,int start)
   }
   return -1;
 }
+
+// Decompresses bam blocks ahead of parsing in nThreads threads. Can be
+// called once, at any point of parsing.
+bool AliParser::setNumThreads(int nThreads)
+{
+  if (!bam || nThreads <= 1) return false;
+  if (samthreads(file,nThreads,8) < 0) {
+    cerr<<"Can't decompress bam file in "<<nThreads<<" threads."<<endl;
+    return false;
+  }
+  return true;
+}
+
+// Decodes only fixed fields and CIGAR of bam records, skipping name,
+// sequence, qualities and tags. Query name is not available then.
+bool AliParser::setCoreOnly(bool coreOnly)
+{
+  if (!bam) return false;
+  core_only_ = coreOnly;
+  return true;
+}
+
+// Restricts parsing to records overlapping given region of chromosome
+// with index chr_index. Zero end means till the end of chromosome.
+bool AliParser::setRegion(int chr_index,int start,int end)
+{
+  if (!bam || !index) return false;
+  if (chr_index < 0 || chr_index >= n_chr_) return false;
+  if (end <= 0) end = clens_[chr_index];
+  if (iter) bam_iter_destroy(iter);
+  iter = bam_iter_query(index,chr_index,start,end);
+  return iter != NULL;
+}
@@ -17,15 +17,19 @@ private:
   ifstream    *samin;
   samfile_t   *file;
   bam_index_t *index;
+  bam_iter_t   iter;
   bam1_t      *record;
   string      *cnames_;
   int         *clens_;
   int          n_chr_;
+  bool         core_only_;
 
 public:
   int    numChrom() { return n_chr_; }
   string chromName(int i) { return (i >= 0 && i < n_chr_) ? cnames_[i] : ""; }
   int    chromLen(int i)  { return (i >= 0 && i < n_chr_) ? clens_[i] : 0; }
+  bool   isBam()    { return bam; }
+  bool   hasIndex() { return index != NULL; }
 
 private: // Chromosome
   string chr_;
@@ -73,14 +77,20 @@ public:
   inline bool isDuplicate()    { return flag_ & 0x400; }
 
 public:
-  inline string getQueryName() { return (record) ? bam1_qname(record) : ""; }
+  inline string getQueryName() {
+    return (record && !core_only_) ? bam1_qname(record) : "";
+  }
 
 public:
-  AliParser(string fileName,bool loadIndex = false);
+  // With nThreads > 1 bam blocks are decompressed ahead by nThreads threads
+  AliParser(string fileName,bool loadIndex = false,int nThreads = 1);
   ~AliParser();
 
   bool parseRecord();
   int  scrollTo(string chrom,int start);
+  bool setRegion(int chr_index,int start = 0,int end = 0);
+  bool setNumThreads(int nThreads);
+  bool setCoreOnly(bool coreOnly);
 
 private:
   bool parseSamLine(istream *sin);
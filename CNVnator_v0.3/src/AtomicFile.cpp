@@ -0,0 +1,42 @@
+// C/C++ includes
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Application includes
+#include "AtomicFile.hh"
+
+AtomicFile::AtomicFile(string name) : name_(name),
+				      tmpName_(""),
+				      f_(NULL)
+{
+  char suffix[32];
+  snprintf(suffix,32,".%d",(int)getpid());
+  tmpName_ = name_ + suffix;
+  f_ = fopen(tmpName_.c_str(),"wb");
+}
+
+AtomicFile::~AtomicFile()
+{
+  if (!f_) return;
+  fclose(f_);
+  remove(tmpName_.c_str());
+}
+
+bool AtomicFile::commit(bool ok)
+{
+  if (!f_) return false;
+  ok = fclose(f_) == 0 && ok;
+  f_ = NULL;
+  if (ok) ok = rename(tmpName_.c_str(),name_.c_str()) == 0;
+  if (!ok) remove(tmpName_.c_str());
+  return ok;
+}
+
+bool AtomicFile::stamp(string name,long long &size,long long &mtime)
+{
+  struct stat st;
+  if (stat(name.c_str(),&st) != 0) return false;
+  size  = st.st_size;
+  mtime = st.st_mtime;
+  return true;
+}
@@ -0,0 +1,38 @@
+#ifndef __ATOMICFILE_HH__
+#define __ATOMICFILE_HH__
+
+// C/C++ includes
+#include <cstdio>
+#include <string>
+using namespace std;
+
+// File written anew under temporary name (file name with process id
+// appended) and renamed over the file by commit(), so that runs reading
+// the old file, e.g., through mmap, keep reading it and never see partial
+// file. Temporary file is removed if writing fails or isn't committed.
+class AtomicFile
+{
+private:
+  string name_,tmpName_;
+  FILE  *f_;
+
+public:
+  AtomicFile(string name);
+  ~AtomicFile();
+
+  inline bool   isOpen()  { return f_ != NULL; }
+  inline FILE  *file()    { return f_; }
+  inline string tmpName() { return tmpName_; }
+
+  // Closes file and, if ok, renames it; false if anything fails
+  bool commit(bool ok);
+
+  // Size and modification time of file; false if it can't be found
+  static bool stamp(string name,long long &size,long long &mtime);
+
+private:
+  AtomicFile(const AtomicFile&);
+  AtomicFile &operator=(const AtomicFile&);
+};
+
+#endif
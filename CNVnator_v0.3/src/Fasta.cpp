@@ -0,0 +1,189 @@
+// C/C++ includes
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Samtools includes
+#include "bgzf.h"
+#include "faidx.h"
+
+// Application includes
+#include "Fasta.hh"
+#include "Genome.hh"
+
+Fasta::Fasta(string fileName) : file_name_(fileName),
+				fd_(-1),
+				data_(NULL),
+				size_(0),
+				bgzf_(false)
+{
+  bgzf_ = bgzf_is_bgzf(fileName.c_str()) == 1;
+  string fai = fileName + ".fai";
+  if (access(fai.c_str(),R_OK) != 0) {
+    if (bgzf_) {
+      cerr<<"Can't find index '"<<fai<<"' of compressed file '"<<fileName
+	  <<"'. Make it with 'samtools faidx'."<<endl;
+      return;
+    }
+    cout<<"Indexing file '"<<fileName<<"' ..."<<endl;
+    if (fai_build(fileName.c_str()) != 0) {
+      cerr<<"Can't index file '"<<fileName<<"'."<<endl;
+      return;
+    }
+  }
+  if (!readIndex(fai)) {
+    cerr<<"Can't read index '"<<fai<<"'."<<endl;
+    chroms_.clear();
+    return;
+  }
+
+  if (bgzf_) {
+    if (!readBlocks()) {
+      cerr<<"Can't read blocks of compressed file '"<<fileName<<"'."<<endl;
+      chroms_.clear();
+    }
+    return;
+  }
+
+  fd_ = open(fileName.c_str(),O_RDONLY);
+  struct stat st;
+  if (fd_ >= 0 && fstat(fd_,&st) == 0 && st.st_size > 0) {
+    size_ = st.st_size;
+    void *addr = mmap(NULL,size_,PROT_READ,MAP_SHARED,fd_,0);
+    if (addr != MAP_FAILED) data_ = (const char*)addr;
+  }
+  if (!data_) {
+    cerr<<"Can't open file '"<<fileName<<"'."<<endl;
+    chroms_.clear();
+    return;
+  }
+  // Sequences are read once, from start to end
+  madvise((void*)data_,size_,MADV_SEQUENTIAL);
+}
+
+Fasta::~Fasta()
+{
+  if (data_)   munmap((void*)data_,size_);
+  if (fd_ >= 0) close(fd_);
+}
+
+bool Fasta::readIndex(string faiFile)
+{
+  ifstream in(faiFile.c_str());
+  if (!in.is_open()) return false;
+  string line;
+  while (getline(in,line)) {
+    if (line.length() == 0) continue;
+    char name[4096];
+    Chrom ch;
+    if (line.length() >= sizeof(name) ||
+	sscanf(line.c_str(),"%s %d %lld %d %d",name,&ch.len,&ch.offset,
+	       &ch.line_blen,&ch.line_len) != 5) return false;
+    if (ch.len < 0 || ch.line_blen <= 0 || ch.line_len < ch.line_blen)
+      return false;
+    ch.name = name;
+    chroms_.push_back(ch);
+  }
+  return true;
+}
+
+bool Fasta::readBlocks()
+{
+  // Each BGZF block has its compressed size in header (field BSIZE of
+  // extra subfield BC) and uncompressed size in the last four bytes
+  FILE *f = fopen(file_name_.c_str(),"rb");
+  if (!f) return false;
+  long long coffset = 0,uoffset = 0;
+  unsigned char header[18];
+  bool ok = true;
+  while (fread(header,1,18,f) == 18) {
+    if (header[0] != 31 || header[1] != 139 || !(header[3] & 4) ||
+	header[12] != 'B' || header[13] != 'C') {
+      ok = false;
+      break;
+    }
+    int bsize = header[16] | (header[17]<<8);
+    unsigned char isize[4];
+    if (fseeko(f,coffset + bsize + 1 - 4,SEEK_SET) != 0 ||
+	fread(isize,1,4,f) != 4) {
+      ok = false;
+      break;
+    }
+    Block bl;
+    bl.coffset = coffset;
+    bl.uoffset = uoffset;
+    blocks_.push_back(bl);
+    uoffset += isize[0] | (isize[1]<<8) | (isize[2]<<16) |
+      ((long long)isize[3]<<24);
+    coffset += bsize + 1;
+  }
+  fclose(f);
+  return ok && blocks_.size() > 0;
+}
+
+int Fasta::chromIndex(string name)
+{
+  for (int i = 0;i < numChrom();i++)
+    if (chroms_[i].name == name) return i;
+  string can_name = Genome::makeCanonical(name);
+  for (int i = 0;i < numChrom();i++)
+    if (Genome::makeCanonical(chroms_[i].name) == can_name) return i;
+  return -1;
+}
+
+int Fasta::fetch(int chr,char *seq,int max_len)
+{
+  if (chr < 0 || chr >= numChrom()) return -1;
+  const Chrom &ch = chroms_[chr];
+  int n = (ch.len < max_len) ? ch.len : max_len;
+  if (bgzf_) return fetchBGZF(ch,seq,n);
+
+  // Line by line from the mapping
+  for (int i = 0;i < n;i += ch.line_blen) {
+    long long p = ch.offset + (long long)(i/ch.line_blen)*ch.line_len;
+    int l = (n - i < ch.line_blen) ? n - i : ch.line_blen;
+    if (p + l > size_) return -1;
+    memcpy(seq + i,data_ + p,l);
+  }
+  return n;
+}
+
+int Fasta::fetchBGZF(const Chrom &ch,char *seq,int n)
+{
+  if (n == 0) return 0;
+  // Last block starting at or before sequence
+  int low = 0,up = blocks_.size() - 1;
+  while (low < up) {
+    int mid = (low + up + 1)>>1;
+    if (blocks_[mid].uoffset <= ch.offset) low = mid;
+    else                                   up  = mid - 1;
+  }
+  BGZF *fp = bgzf_open(file_name_.c_str(),"r");
+  if (!fp) return -1;
+  long long within = ch.offset - blocks_[low].uoffset;
+  // Offset within block is smaller than 64 kB
+  if (bgzf_seek(fp,(blocks_[low].coffset<<16) | within,SEEK_SET) < 0) {
+    bgzf_close(fp);
+    return -1;
+  }
+  static const int BUFFER = 1<<20;
+  char *buffer = new char[BUFFER];
+  int ret = 0,col = 0;
+  while (ret < n) {
+    int m = bgzf_read(fp,buffer,BUFFER);
+    if (m <= 0) break;
+    // Bases of a line, then line_len - line_blen bytes of line break
+    for (int i = 0;i < m && ret < n;i++) {
+      if (col < ch.line_blen) seq[ret++] = buffer[i];
+      if (++col == ch.line_len) col = 0;
+    }
+  }
+  delete[] buffer;
+  bgzf_close(fp);
+  return (ret == n) ? n : -1;
+}
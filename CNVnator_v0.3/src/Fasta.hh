@@ -0,0 +1,59 @@
+#ifndef __FASTA_HH__
+#define __FASTA_HH__
+
+// C/C++ includes
+#include <string>
+#include <vector>
+using namespace std;
+
+// Reference sequences in one fasta file indexed by samtools faidx
+// (file.fai; made if missing for uncompressed file). Uncompressed file is
+// mapped into memory once and shared by all threads; file compressed with
+// bgzip is read through BGZF blocks found when file is opened. Sequences
+// are copied without line breaks into caller's buffer.
+class Fasta
+{
+private:
+  struct Chrom
+  {
+    string    name;
+    int       len,line_blen,line_len;
+    long long offset;
+  };
+
+  struct Block // BGZF block: offsets in compressed and uncompressed file
+  {
+    long long coffset,uoffset;
+  };
+
+  string               file_name_;
+  int                  fd_;
+  const char          *data_;
+  long long            size_;
+  bool                 bgzf_;
+  vector<Block>        blocks_;
+  vector<Chrom>        chroms_;
+
+public:
+  Fasta(string fileName);
+  ~Fasta();
+
+  inline bool   isOpen()   { return chroms_.size() > 0; }
+  inline string fileName() { return file_name_; }
+  inline int    numChrom() { return chroms_.size(); }
+  inline string chromName(int i) { return chroms_[i].name; }
+  inline int    chromLen(int i)  { return chroms_[i].len; }
+  // Index of chromosome, name compared as given or in canonical form
+  int           chromIndex(string name);
+
+  // Copies at most max_len bases of chromosome into seq; returns number of
+  // bases copied or -1 if they can't be read
+  int fetch(int chr,char *seq,int max_len);
+
+private:
+  bool readIndex(string faiFile);
+  bool readBlocks();
+  int  fetchBGZF(const Chrom &ch,char *seq,int n);
+};
+
+#endif
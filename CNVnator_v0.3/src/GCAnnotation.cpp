@@ -0,0 +1,275 @@
+// C/C++ includes
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Application includes
+#include "GCAnnotation.hh"
+#include "GCIndex.hh"
+#include "AtomicFile.hh"
+
+static const char MAGIC[] = "CNVGCA01";
+static const int  HEADER  = 16;
+
+GCAnnotation::GCAnnotation(string fileName) : fd_(-1),
+					      data_(NULL),
+					      size_(0),
+					      index_(0)
+{
+  fd_ = open(fileName.c_str(),O_RDONLY);
+  if (fd_ < 0) return;
+  struct stat st;
+  if (fstat(fd_,&st) == 0 && st.st_size >= HEADER) {
+    size_ = st.st_size;
+    void *addr = mmap(NULL,size_,PROT_READ,MAP_SHARED,fd_,0);
+    if (addr != MAP_FAILED) data_ = (const unsigned char*)addr;
+  }
+  if (data_ && !readIndex()) {
+    cerr<<"File '"<<fileName<<"' is not a valid annotation file."<<endl;
+    munmap((void*)data_,size_);
+    data_ = NULL;
+    chroms_.clear();
+  }
+}
+
+GCAnnotation::~GCAnnotation()
+{
+  if (data_)   munmap((void*)data_,size_);
+  if (fd_ >= 0) close(fd_);
+}
+
+bool GCAnnotation::readIndex()
+{
+  if (memcmp(data_,MAGIC,8) != 0) return false;
+  memcpy(&index_,data_ + 8,sizeof(index_));
+  if (index_ < HEADER || index_ + 4 > size_) return false;
+  const unsigned char *p = data_ + index_,*end = data_ + size_;
+  unsigned int n_chroms,len,n_bins;
+  memcpy(&n_chroms,p,4); p += 4;
+  chroms_.resize(n_chroms);
+  for (unsigned int c = 0;c < n_chroms;c++) {
+    Chrom &ch = chroms_[c];
+    if (p + 4 > end) return false;
+    memcpy(&len,p,4); p += 4;
+    if (p + len + 24 > end) return false;
+    ch.name.assign((const char*)p,len); p += len;
+    memcpy(&ch.len,     p,4); p += 4;
+    memcpy(&ch.fa_size, p,8); p += 8;
+    memcpy(&ch.fa_mtime,p,8); p += 8;
+    memcpy(&n_bins,     p,4); p += 4;
+    if (ch.len < 0 || p + n_bins*12 + 24 > end) return false;
+    ch.gc.resize(n_bins);
+    for (unsigned int b = 0;b < n_bins;b++) {
+      BinGC &g = ch.gc[b];
+      memcpy(&g.bin,   p,4); p += 4;
+      memcpy(&g.offset,p,8); p += 8;
+      if (g.bin <= 0 || g.offset < HEADER ||
+	  g.offset + ch.len/g.bin + 1 > index_) return false;
+    }
+    memcpy(&ch.n_at,     p,4); p += 4;
+    memcpy(&ch.at_offset,p,8); p += 8;
+    memcpy(&ch.n_gc,     p,4); p += 4;
+    memcpy(&ch.gc_offset,p,8); p += 8;
+    if (ch.at_offset < HEADER || ch.at_offset + 8LL*ch.n_at > index_ ||
+	ch.gc_offset < HEADER || ch.gc_offset + 8LL*ch.n_gc > index_ ||
+	ch.at_offset%4 != 0 || ch.gc_offset%4 != 0) return false;
+  }
+  return true;
+}
+
+int GCAnnotation::chromIndex(string name)
+{
+  for (int i = 0;i < numChrom();i++)
+    if (chroms_[i].name == name) return i;
+  return -1;
+}
+
+bool GCAnnotation::isCurrent(int chr,string fastaFile)
+{
+  long long size,mtime;
+  if (!AtomicFile::stamp(fastaFile,size,mtime)) return true;
+  return size == chroms_[chr].fa_size && mtime == chroms_[chr].fa_mtime;
+}
+
+const signed char *GCAnnotation::gcPercent(int chr,int bin)
+{
+  const vector<BinGC> &gc = chroms_[chr].gc;
+  for (unsigned int b = 0;b < gc.size();b++)
+    if (gc[b].bin == bin) return (const signed char*)(data_ + gc[b].offset);
+  return NULL;
+}
+
+void GCAnnotation::annotate(const char *seq,int len,int *bins,int n_bins,
+			    Data &data)
+{
+  data.len = len;
+  data.bins.assign(bins,bins + n_bins);
+  data.gc.resize(n_bins);
+  for (int b = 0;b < n_bins;b++) {
+    // Same bins as in histograms made by -his
+    int n = len/bins[b] + 1;
+    data.gc[b].resize(n);
+    for (int i = 0;i < n;i++) {
+      int start = i*bins[b],end = start + bins[b],n_gc,n_at;
+      if (start > len) start = len;
+      if (end   > len) end   = len;
+      GCIndex::count(seq + start,end - start,n_gc,n_at);
+      if (n_gc + n_at == 0) data.gc[b][i] = -100;
+      else data.gc[b][i] = int(n_gc*100./(n_gc + n_at) + 0.5);
+    }
+  }
+  findRuns(seq,len,data.at_starts,data.at_ends,data.gc_starts,data.gc_ends);
+}
+
+void GCAnnotation::findRuns(const char *seq,int len,
+			    vector<int> &at_starts,vector<int> &at_ends,
+			    vector<int> &gc_starts,vector<int> &gc_ends)
+{
+  at_starts.clear(); at_ends.clear();
+  gc_starts.clear(); gc_ends.clear();
+  for (int i = 0;i < len;i++) {
+    char c;
+    int ats = i,ate = i;
+    while (i < len && (c = seq[i]) &&
+	   (c == 'A' || c == 'a' || c == 'T' || c == 't')) ate = i++;
+    if (ate - ats + 1 >= MIN_RUN) {
+      at_starts.push_back(ats + 1);
+      at_ends.push_back(ate + 1);
+    }
+    int gcs = i,gce = i;
+    while (i < len && (c = seq[i]) &&
+	   (c == 'C' || c == 'c' || c == 'G' || c == 'g')) gce = i++;
+    if (gce - gcs + 1 >= MIN_RUN) {
+      gc_starts.push_back(gcs + 1);
+      gc_ends.push_back(gce + 1);
+    }
+    if (i > ats) i--;
+  }
+}
+
+static bool writeInts(FILE *f,const int *v,unsigned int n)
+{
+  return n == 0 || fwrite(v,4,n,f) == n;
+}
+
+static const int *intsOf(vector<int> &v)
+{
+  return v.size() > 0 ? &v[0] : NULL;
+}
+
+bool GCAnnotation::writeData(FILE *f,Chrom &ch,const signed char **gc,
+			     const int *at_starts,const int *at_ends,
+			     const int *gc_starts,const int *gc_ends)
+{
+  bool ok = true;
+  for (unsigned int b = 0;ok && b < ch.gc.size();b++) {
+    unsigned int n = ch.len/ch.gc[b].bin + 1;
+    ch.gc[b].offset = ftello(f);
+    ok = fwrite(gc[b],1,n,f) == n;
+  }
+  // Runs are aligned to 4 bytes
+  static const char pad[4] = {0,0,0,0};
+  long long pos = ftello(f);
+  if (ok && pos%4 != 0) {
+    size_t n_pad = 4 - pos%4;
+    ok = fwrite(pad,1,n_pad,f) == n_pad;
+  }
+  ch.at_offset = ftello(f);
+  ok = ok && writeInts(f,at_starts,ch.n_at) && writeInts(f,at_ends,ch.n_at);
+  ch.gc_offset = ftello(f);
+  ok = ok && writeInts(f,gc_starts,ch.n_gc) && writeInts(f,gc_ends,ch.n_gc);
+  return ok;
+}
+
+bool GCAnnotation::writeIndex(FILE *f,vector<Chrom> &chroms)
+{
+  long long index = ftello(f);
+  unsigned int n_chroms = chroms.size();
+  bool ok = fwrite(&n_chroms,4,1,f) == 1;
+  for (unsigned int c = 0;ok && c < n_chroms;c++) {
+    Chrom &chr = chroms[c];
+    unsigned int name_len = chr.name.length(),n_bins = chr.gc.size();
+    ok = fwrite(&name_len,4,1,f) == 1 &&
+      fwrite(chr.name.c_str(),1,name_len,f) == name_len &&
+      fwrite(&chr.len,4,1,f) == 1 &&
+      fwrite(&chr.fa_size,8,1,f) == 1 && fwrite(&chr.fa_mtime,8,1,f) == 1 &&
+      fwrite(&n_bins,4,1,f) == 1;
+    for (unsigned int b = 0;ok && b < n_bins;b++)
+      ok = fwrite(&chr.gc[b].bin,4,1,f) == 1 &&
+	fwrite(&chr.gc[b].offset,8,1,f) == 1;
+    ok = ok && fwrite(&chr.n_at,4,1,f) == 1 &&
+      fwrite(&chr.at_offset,8,1,f) == 1 &&
+      fwrite(&chr.n_gc,4,1,f) == 1 && fwrite(&chr.gc_offset,8,1,f) == 1;
+  }
+  // Offset of index in header
+  return ok && fseeko(f,8,SEEK_SET) == 0 && fwrite(&index,8,1,f) == 1;
+}
+
+GCAnnotation::Writer::Writer(string fileName) : fileName_(fileName),
+						file_(fileName),
+						f_(file_.file()),
+						ok_(false)
+{
+  if (!f_) {
+    cerr<<"Can't open/write to file '"<<file_.tmpName()<<"'."<<endl;
+    return;
+  }
+  long long zero = 0;
+  ok_ = fwrite(MAGIC,1,8,f_) == 8 && fwrite(&zero,8,1,f_) == 1;
+}
+
+bool GCAnnotation::Writer::add(string chrom,string fastaFile,Data &data)
+{
+  if (!f_) return false;
+  Chrom ch;
+  ch.name = chrom;
+  ch.len  = data.len;
+  ch.fa_size = ch.fa_mtime = 0;
+  AtomicFile::stamp(fastaFile,ch.fa_size,ch.fa_mtime);
+  vector<const signed char*> gc(data.bins.size() + 1);
+  for (unsigned int b = 0;b < data.bins.size();b++) {
+    BinGC g;
+    g.bin    = data.bins[b];
+    g.offset = 0;
+    ch.gc.push_back(g);
+    gc[b] = &data.gc[b][0];
+  }
+  ch.n_at = data.at_starts.size();
+  ch.n_gc = data.gc_starts.size();
+  ok_ = ok_ && writeData(f_,ch,&gc[0],
+			 intsOf(data.at_starts),intsOf(data.at_ends),
+			 intsOf(data.gc_starts),intsOf(data.gc_ends));
+  for (unsigned int c = 0;c < chroms_.size();c++)
+    if (chroms_[c].name == chrom) chroms_.erase(chroms_.begin() + c--);
+  chroms_.push_back(ch);
+  return ok_;
+}
+
+bool GCAnnotation::Writer::close()
+{
+  if (!f_) return false;
+  GCAnnotation old(fileName_);
+  vector<Chrom> chroms;
+  for (int i = 0;ok_ && i < old.numChrom();i++) {
+    Chrom ch = old.chroms_[i];
+    bool added = false;
+    for (unsigned int c = 0;c < chroms_.size();c++)
+      if (chroms_[c].name == ch.name) added = true;
+    if (added) continue;
+    vector<const signed char*> gc(ch.gc.size() + 1);
+    for (unsigned int b = 0;b < ch.gc.size();b++)
+      gc[b] = (const signed char*)(old.data_ + ch.gc[b].offset);
+    ok_ = writeData(f_,ch,&gc[0],old.atStarts(i),old.atEnds(i),
+		    old.gcStarts(i),old.gcEnds(i));
+    chroms.push_back(ch);
+  }
+  chroms.insert(chroms.end(),chroms_.begin(),chroms_.end());
+  ok_ = ok_ && writeIndex(f_,chroms);
+  ok_ = file_.commit(ok_);
+  f_ = NULL;
+  if (!ok_) cerr<<"Can't write to file '"<<fileName_<<"'."<<endl;
+  return ok_;
+}
@@ -0,0 +1,135 @@
+#ifndef __GCANNOTATION_HH__
+#define __GCANNOTATION_HH__
+
+// C/C++ includes
+#include <cstdio>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Application includes
+#include "AtomicFile.hh"
+
+// Reference annotation shared by samples: GC content per bin of
+// chromosomes for several bin sizes, and runs of at least MIN_RUN A/T and
+// of G/C bases. Made once by -prepare-reference and read through mmap, so
+// that -his and -aggregate don't read fasta files. File layout:
+//
+//   header: magic "CNVGCA01", uint64 offset of index
+//   data:   per chromosome and bin size int8 GC percentage per bin (-100
+//           for bins without A, C, G or T); per chromosome int32 starts,
+//           then int32 ends (1-based) of AT runs, and the same of GC runs
+//   index:  uint32 number of chromosomes, then per chromosome uint32 name
+//           length, name, int32 length, int64 size and int64 modification
+//           time of fasta file, uint32 number of bin sizes and per bin size
+//           int32 bin size, uint64 offset; uint32 number of AT runs, uint64
+//           offset, uint32 number of GC runs, uint64 offset
+class GCAnnotation
+{
+public:
+  static const int MIN_RUN = 10;
+
+  // Annotation of one chromosome made from its sequence (see annotate())
+  struct Data
+  {
+    int                          len;
+    vector<int>                  bins;
+    vector< vector<signed char> > gc;
+    vector<int>                  at_starts,at_ends,gc_starts,gc_ends;
+  };
+
+private:
+  struct BinGC
+  {
+    int       bin;
+    long long offset;
+  };
+
+  struct Chrom
+  {
+    string         name;
+    int            len;
+    long long      fa_size,fa_mtime;
+    vector<BinGC>  gc;
+    unsigned int   n_at,n_gc;
+    long long      at_offset,gc_offset;
+  };
+
+  int                  fd_;
+  const unsigned char *data_;
+  long long            size_,index_;
+  vector<Chrom>        chroms_;
+
+public:
+  GCAnnotation(string fileName);
+  ~GCAnnotation();
+
+  inline bool   isOpen()   { return data_ != NULL; }
+  inline int    numChrom() { return chroms_.size(); }
+  inline string chromName(int i) { return chroms_[i].name; }
+  inline int    chromLen(int i)  { return chroms_[i].len; }
+  int           chromIndex(string name);
+
+  // Annotation file in reference directory
+  static string nameFor(string dir) { return dir + "/cnvnator.gca"; }
+
+  // True unless fasta file exists and has changed since annotation
+  bool isCurrent(int chr,string fastaFile);
+
+  // GC percentage for bins 1, 2, ... (at index 0, 1, ...) of size bin;
+  // NULL if chromosome is not annotated for the bin size
+  const signed char *gcPercent(int chr,int bin);
+
+  inline int numATRuns(int chr) { return chroms_[chr].n_at; }
+  inline int numGCRuns(int chr) { return chroms_[chr].n_gc; }
+  inline const int *atStarts(int chr)
+  { return (const int*)(data_ + chroms_[chr].at_offset); }
+  inline const int *atEnds(int chr) { return atStarts(chr) + numATRuns(chr); }
+  inline const int *gcStarts(int chr)
+  { return (const int*)(data_ + chroms_[chr].gc_offset); }
+  inline const int *gcEnds(int chr) { return gcStarts(chr) + numGCRuns(chr); }
+
+  // Making annotation of sequence seq[0 .. len) for bin sizes bins
+  static void annotate(const char *seq,int len,int *bins,int n_bins,
+		       Data &data);
+  static void findRuns(const char *seq,int len,
+		       vector<int> &at_starts,vector<int> &at_ends,
+		       vector<int> &gc_starts,vector<int> &gc_ends);
+
+  // Writing annotation file anew under temporary name: chromosomes are
+  // added as they are made, then close() copies chromosomes of the old
+  // file that weren't added, writes index and renames the file over the
+  // old one. Runs that have the old file mapped keep reading it, and a
+  // failed or unclosed write leaves it as it is.
+  class Writer
+  {
+  private:
+    string        fileName_;
+    AtomicFile    file_;
+    FILE         *f_;
+    bool          ok_;
+    vector<Chrom> chroms_;
+
+  public:
+    Writer(string fileName);
+
+    inline bool isOpen() { return f_ != NULL; }
+
+    // Adds chromosome made from fasta file; not thread safe
+    bool add(string chrom,string fastaFile,Data &data);
+    bool close();
+
+  private:
+    Writer(const Writer&);
+    Writer &operator=(const Writer&);
+  };
+
+private:
+  bool readIndex();
+  static bool writeData(FILE *f,Chrom &ch,const signed char **gc,
+			const int *at_starts,const int *at_ends,
+			const int *gc_starts,const int *gc_ends);
+  static bool writeIndex(FILE *f,vector<Chrom> &chroms);
+};
+
+#endif
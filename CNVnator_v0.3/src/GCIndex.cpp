@@ -0,0 +1,151 @@
+// C/C++ includes
+#include <cstdio>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Application includes
+#include "GCIndex.hh"
+#include "AtomicFile.hh"
+
+static const char MAGIC[] = "CNVGCI01";
+
+void GCIndex::count(const char *seq,int len,int &n_gc,int &n_at)
+{
+  const unsigned char *s = (const unsigned char*)seq;
+  n_gc = n_at = 0;
+  int p = 0;
+#ifdef __SSE2__
+  // 16 bases at a time; matches (-1 per byte) are subtracted from byte
+  // counters, which can't overflow within 255 steps, and are then summed
+  // by _mm_sad_epu8()
+  const __m128i lower = _mm_set1_epi8(0x20),zero = _mm_setzero_si128();
+  const __m128i g = _mm_set1_epi8('g'),c = _mm_set1_epi8('c');
+  const __m128i a = _mm_set1_epi8('a'),t = _mm_set1_epi8('t');
+  while (len - p >= 16) {
+    int end = p + 16*255;
+    if (end > len) end = p + ((len - p) & ~15);
+    __m128i gc = zero,at = zero;
+    for (;p < end;p += 16) {
+      __m128i v = _mm_or_si128(_mm_loadu_si128((const __m128i*)(s + p)),
+			       lower);
+      gc = _mm_sub_epi8(gc,_mm_or_si128(_mm_cmpeq_epi8(v,g),
+					_mm_cmpeq_epi8(v,c)));
+      at = _mm_sub_epi8(at,_mm_or_si128(_mm_cmpeq_epi8(v,a),
+					_mm_cmpeq_epi8(v,t)));
+    }
+    gc = _mm_sad_epu8(gc,zero);
+    at = _mm_sad_epu8(at,zero);
+    n_gc += _mm_cvtsi128_si32(gc) + _mm_extract_epi16(gc,4);
+    n_at += _mm_cvtsi128_si32(at) + _mm_extract_epi16(at,4);
+  }
+#endif
+  // Byte counters can't overflow within 255 bases
+  while (p < len) {
+    int end = (len - p > 255) ? p + 255 : len;
+    unsigned char gc = 0,at = 0;
+    for (;p < end;p++) {
+      unsigned char c = s[p] | 0x20; // Lower case
+      gc += (c == 'g') | (c == 'c');
+      at += (c == 'a') | (c == 't');
+    }
+    n_gc += gc;
+    n_at += at;
+  }
+}
+
+void GCIndex::build(const char *seq,int len)
+{
+  int n = (len + CHUNK - 1)/CHUNK;
+  len_ = len;
+  gc_.resize(n + 1);
+  at_.resize(n + 1);
+  gc_[0] = at_[0] = 0;
+  for (int j = 0;j < n;j++) {
+    int n_gc,n_at,start = j*CHUNK;
+    count(seq + start,(len - start < CHUNK) ? len - start : CHUNK,n_gc,n_at);
+    gc_[j + 1] = gc_[j] + n_gc;
+    at_[j + 1] = at_[j] + n_at;
+  }
+}
+
+int GCIndex::sums(int step,int *gc_sum,int *at_sum)
+{
+  int n = (len_ + step - 1)/step,k = step/CHUNK,n_chunks = numChunks();
+  for (int j = 0;j <= n;j++) {
+    int c = j*k;
+    if (c > n_chunks) c = n_chunks;
+    gc_sum[j] = gc_[c];
+    at_sum[j] = at_[c];
+  }
+  return n;
+}
+
+string GCIndex::nameFor(string fastaFile,string chrom)
+{
+  string single = chrom + ".fa";
+  int len = fastaFile.length(),slen = single.length();
+  if (fastaFile == single ||
+      (len > slen && fastaFile.substr(len - slen - 1) == "/" + single))
+    return fastaFile + ".gci";
+  return fastaFile + "." + chrom + ".gci";
+}
+
+bool GCIndex::load(string fastaFile,string chrom)
+{
+  long long size,mtime;
+  if (!AtomicFile::stamp(fastaFile,size,mtime)) return false;
+  FILE *f = fopen(nameFor(fastaFile,chrom).c_str(),"rb");
+  if (!f) return false;
+  char magic[8];
+  long long fsize,fmtime;
+  int len,chunk;
+  bool ok = fread(magic,1,8,f) == 8 && memcmp(magic,MAGIC,8) == 0 &&
+    fread(&fsize,8,1,f) == 1 && fread(&fmtime,8,1,f) == 1 &&
+    fread(&len,4,1,f) == 1 && fread(&chunk,4,1,f) == 1 &&
+    fsize == size && fmtime == mtime && len >= 0 && chunk == CHUNK;
+  if (ok) {
+    int n = (len + CHUNK - 1)/CHUNK;
+    size_t n_bytes = 2*n;
+    vector<unsigned char> counts(n_bytes);
+    ok = n == 0 || fread(&counts[0],1,n_bytes,f) == n_bytes;
+    if (ok) {
+      len_ = len;
+      gc_.resize(n + 1);
+      at_.resize(n + 1);
+      gc_[0] = at_[0] = 0;
+      for (int j = 0;j < n;j++) {
+	gc_[j + 1] = gc_[j] + counts[2*j];
+	at_[j + 1] = at_[j] + counts[2*j + 1];
+      }
+    }
+  }
+  fclose(f);
+  return ok;
+}
+
+bool GCIndex::save(string fastaFile,string chrom)
+{
+  long long size,mtime;
+  if (!AtomicFile::stamp(fastaFile,size,mtime)) return false;
+  int n = numChunks(),chunk = CHUNK;
+  size_t n_bytes = 2*n;
+  vector<unsigned char> counts(n_bytes);
+  for (int j = 0;j < n;j++) {
+    counts[2*j]     = gc_[j + 1] - gc_[j];
+    counts[2*j + 1] = at_[j + 1] - at_[j];
+  }
+
+  // Written under temporary name and renamed, so that runs sharing the
+  // same reference never see partial file. Index is only a cache, so
+  // failure, e.g., in read-only reference directory, is not reported.
+  AtomicFile out(nameFor(fastaFile,chrom));
+  FILE *f = out.file();
+  if (!f) return false;
+  bool ok = fwrite(MAGIC,1,8,f) == 8 &&
+    fwrite(&size,8,1,f) == 1 && fwrite(&mtime,8,1,f) == 1 &&
+    fwrite(&len_,4,1,f) == 1 && fwrite(&chunk,4,1,f) == 1 &&
+    (n == 0 || fwrite(&counts[0],1,n_bytes,f) == n_bytes);
+  return out.commit(ok);
+}
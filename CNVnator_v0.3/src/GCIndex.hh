@@ -0,0 +1,54 @@
+#ifndef __GCINDEX_HH__
+#define __GCINDEX_HH__
+
+// C/C++ includes
+#include <string>
+#include <vector>
+using namespace std;
+
+// Prefix counts of GC and AT bases of a chromosome over chunks of CHUNK
+// bases (other bases, e.g., N, are the rest of a chunk), so GC content of
+// any region aligned to chunks is a subtraction. Index is cached in file
+// next to the fasta file (see nameFor()) and is used for as long as size
+// and modification time of the fasta file are the same. File layout:
+//
+//   header: magic "CNVGCI01", int64 size and int64 modification time of
+//           fasta file, int32 sequence length, int32 chunk size
+//   counts: per chunk uint8 number of GC and uint8 number of AT bases
+class GCIndex
+{
+public:
+  static const int CHUNK = 100;
+
+private:
+  int         len_;
+  vector<int> gc_,at_; // Bases in [0 .. j*CHUNK), j up to number of chunks
+
+public:
+  GCIndex() : len_(0),gc_(1,0),at_(1,0) {}
+
+  inline int length()    { return len_; }
+  inline int numChunks() { return gc_.size() - 1; }
+
+  // Counts GC and AT bases in seq[0 .. len). Bytes are classified without
+  // branches, 16 at a time with SSE2 where available.
+  static void count(const char *seq,int len,int &n_gc,int &n_at);
+
+  // Index of sequence seq[0 .. len)
+  void build(const char *seq,int len);
+
+  // Prefix sums of GC and AT over chunks of step bases as made by
+  // sumGCandAT(); step must be multiple of CHUNK. Returns number of chunks.
+  int sums(int step,int *gc_sum,int *at_sum);
+
+  // Index cached for chromosome in fasta file; false if there is none or
+  // it is outdated
+  bool load(string fastaFile,string chrom);
+  bool save(string fastaFile,string chrom);
+
+  // Name of file going along with fasta file: chrN.fa.gci for file with
+  // one chromosome, ref.fa.chrN.gci for file with whole reference
+  static string nameFor(string fastaFile,string chrom);
+};
+
+#endif
@@ -0,0 +1,44 @@
+// Application includes
+#include "GCProfile.hh"
+
+const double GCProfile::MAX_RD = 5000;
+
+GCProfile::GCProfile(int bin_size) : n_(0),inv_width_(0)
+{
+  // Same bins as in histograms of GC vs RD correlation
+  int n_bins = 100;
+  if (bin_size < n_bins) n_bins = bin_size;
+  if (n_bins < 1) n_bins = 1;
+  n_ = n_bins + 1;
+  inv_width_ = n_bins/100.;
+  sum_.assign(n_,0);
+  count_.assign(n_,0);
+}
+
+void GCProfile::reset()
+{
+  sum_.assign(n_,0);
+  count_.assign(n_,0);
+}
+
+void GCProfile::averages(double *average)
+{
+  for (int ind = 0;ind < n_;ind++) {
+    if (ind/inv_width_ > 89.99) {
+      double s = 0;
+      long   c = 0;
+      for (int i = ind;i < n_;i++) s += sum_[i], c += count_[i];
+      double av = (c > 0) ? s/c : 0;
+      while (ind < n_) average[ind++] = av;
+    } else
+      average[ind] = (count_[ind] > 0) ? sum_[ind]/count_[ind] : 0;
+  }
+}
+
+void GCProfile::correction(double global_average,double *corr)
+{
+  averages(corr);
+  for (int i = 0;i < n_;i++)
+    if (corr[i] == 0) corr[i] = -1;
+    else corr[i] = global_average/corr[i];
+}
@@ -0,0 +1,50 @@
+#ifndef __GCPROFILE_HH__
+#define __GCPROFILE_HH__
+
+// C/C++ includes
+#include <vector>
+using namespace std;
+
+// Average RD per bin of GC-content, accumulated as sum and count of RD
+// values in each GC bin. Bins are the same as of GC vs RD histograms
+// (rd_gc_*), and RD values are counted as in them, i.e., rounded to integer
+// and only in range 0 .. 5000, so averages equal means of their projections
+// on RD axis.
+class GCProfile
+{
+private:
+  static const double MAX_RD;
+
+  int n_;               // Number of GC bins
+  double inv_width_;    // Inverse of GC bin width
+  vector<double> sum_;
+  vector<long>   count_;
+
+public:
+  GCProfile(int bin_size);
+
+  inline int numBins() { return n_; }
+  inline int index(double gc) // -1 if GC is not known
+  {
+    if (gc < 0) return -1;
+    int ind = (int)(gc*inv_width_ + .5);
+    return (ind < n_) ? ind : -1;
+  }
+  inline void fill(double gc,double rd)
+  {
+    int ind = index(gc);
+    if (ind < 0 || rd < -0.5 || rd >= MAX_RD + 0.5) return;
+    sum_[ind] += (int)(rd + 0.5);
+    count_[ind]++;
+  }
+  void reset();
+
+  // Average RD for each GC bin, 0 if there are no values; bins above 90%
+  // are merged as they have few values
+  void averages(double *average);
+  // Factors correcting RD to global average for each GC bin, -1 if bin
+  // has no values
+  void correction(double global_average,double *corr);
+};
+
+#endif
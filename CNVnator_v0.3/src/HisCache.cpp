@@ -0,0 +1,97 @@
+// Application includes
+#include "HisCache.hh"
+
+HisCache::HisCache() : n_bins_(0)
+{}
+
+HisCache::~HisCache()
+{
+  clear();
+}
+
+TString HisCache::makeKey(TString file,TString dir,TString name)
+{
+  return file + ":" + dir + "/" + name;
+}
+
+void HisCache::drop(list<Entry>::iterator it)
+{
+  n_bins_ -= it->n_bins;
+  delete it->his;
+  entries_.erase(it);
+}
+
+TH1 *HisCache::get(TString file,TString dir,TString name)
+{
+  TString key = makeKey(file,dir,name);
+  for (list<Entry>::iterator it = entries_.begin();it != entries_.end();it++)
+    if (it->key == key) {
+      entries_.splice(entries_.begin(),entries_,it);
+      gROOT->cd();
+      return (TH1*)it->his->Clone(name);
+    }
+  return NULL;
+}
+
+void HisCache::put(TString file,TString dir,TString name,TH1 *his)
+{
+  if (!his) return;
+  remove(file,dir,name);
+  long n_bins = (long)(his->GetNbinsX() + 2)*(his->GetNbinsY() + 2)*
+    (his->GetNbinsZ() + 2);
+  if (n_bins > MAX_BINS) return;
+  while (n_bins_ + n_bins > MAX_BINS) drop(--entries_.end());
+  Entry e;
+  e.key    = makeKey(file,dir,name);
+  e.his    = (TH1*)his->Clone(name);
+  e.his->SetDirectory(0);
+  e.n_bins = n_bins;
+  entries_.push_front(e);
+  n_bins_ += n_bins;
+}
+
+void HisCache::remove(TString file,TString dir,TString name)
+{
+  TString key = makeKey(file,dir,name);
+  for (list<Entry>::iterator it = entries_.begin();it != entries_.end();it++)
+    if (it->key == key) {
+      drop(it);
+      return;
+    }
+}
+
+TFile *HisCache::getFile(TString file)
+{
+  map<TString,TFile*>::iterator it = files_.find(file);
+  if (it != files_.end()) return it->second;
+  TFile *ret = new TFile(file);
+  gROOT->cd();
+  if (ret->IsZombie()) {
+    delete ret;
+    return NULL;
+  }
+  files_[file] = ret;
+  return ret;
+}
+
+void HisCache::closeFile(TString file)
+{
+  map<TString,TFile*>::iterator it = files_.find(file);
+  if (it == files_.end()) return;
+  it->second->Close();
+  delete it->second;
+  files_.erase(it);
+  gROOT->cd();
+}
+
+void HisCache::clear()
+{
+  while (entries_.size() > 0) drop(entries_.begin());
+  for (map<TString,TFile*>::iterator it = files_.begin();
+       it != files_.end();it++) {
+    it->second->Close();
+    delete it->second;
+  }
+  files_.clear();
+  gROOT->cd();
+}
@@ -0,0 +1,60 @@
+#ifndef __HISCACHE_HH__
+#define __HISCACHE_HH__
+
+// C/C++ includes
+#include <list>
+#include <map>
+using namespace std;
+
+// ROOT includes
+#include <TROOT.h>
+#include <TFile.h>
+#include <TH1.h>
+
+// Histograms read from root files, kept by file, directory and name, and
+// open handles of root files. Least recently used histograms are dropped
+// once more than MAX_BINS bins are held. Not thread safe: callers must
+// serialize access, as they do for other ROOT calls.
+class HisCache
+{
+private:
+  static const long MAX_BINS = 1<<26;
+
+  struct Entry
+  {
+    TString key;
+    TH1    *his;
+    long    n_bins;
+  };
+
+  list<Entry>          entries_; // Most recently used first
+  long                 n_bins_;
+  map<TString,TFile*>  files_;
+
+public:
+  HisCache();
+  ~HisCache();
+
+  // Copy of cached histogram, or NULL if it isn't cached
+  TH1 *get(TString file,TString dir,TString name);
+
+  // Caches copy of histogram
+  void put(TString file,TString dir,TString name,TH1 *his);
+
+  // Drops cached histogram, e.g., when it is written anew
+  void remove(TString file,TString dir,TString name);
+
+  // Open handle for reading file, NULL if file can't be opened
+  TFile *getFile(TString file);
+
+  // Closes handle for file, e.g., when file is changed by a writer
+  void closeFile(TString file);
+
+  void clear();
+
+private:
+  TString makeKey(TString file,TString dir,TString name);
+  void    drop(list<Entry>::iterator it);
+};
+
+#endif
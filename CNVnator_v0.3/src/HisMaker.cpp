@@ -1,10 +1,18 @@
+// C/C++ includes
+#include <vector>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+
 // Application includes
 #include "HisMaker.hh"
 #include "Genotyper.hh"
 #include "Genome.hh"
 #include "Interval.hh"
+#include "LevelGradient.hh"
 
 static const int N_CHROM_MAX = 100000;
+static const int N_T_NORMAL  = 1000;
 
 double my_gaus(double *x_arr,double *par)
 {
@@ -39,14 +47,88 @@ void normalize(TH1 *his,double max = 1,double min = -1,double norm = -1)
     else          his->Scale(1./sum);
 }
 
+// Data shared by threads working on chromosomes in produceHistograms(),
+// stat(), partition() and callSVs(). Anything touching ROOT (files,
+// making/deleting histograms, fitting) is done under pool lock. Statistics
+// over all chromosomes are filled into copies per thread and summed up once
+// all chromosomes are done.
+struct ChromosomeJobs
+{
+  HisMaker   *maker;
+  ThreadPool *pool;
+  string     *chroms;
+  bool        useATcorr,useGCcorr;
+  // produceHistograms()
+  string     *root_files;
+  int         n_root_files,*chrom_lens,*bins,n_bins,step,max_len;
+  int       **counts;     // Per thread
+  char      **seq_buffer; // Per thread
+  GCAnnotation *annotation; // Of reference, if any
+  // prepareReference()
+  GCAnnotation::Writer *writer;
+  // stat()
+  TH1        *his_read,*his_frg;
+  double      range_at,norm_frg,norm_read,shift,p0,p1;
+  // partition()
+  bool        skipMasked;
+  int         range,level_threads; // Threads per chromosome in calcLevels()
+  TH1       **rd_level,**frag_len,**dl,**dl2; // Per thread
+  // callSVs()
+  bool        relax;
+  int         region_threads; // Threads per chromosome refining regions
+  TH1       **rd_level_merge; // Per thread
+  string     *calls;          // Per chromosome
+  // Metrics
+  long       *items; // Per chromosome, reads or bins processed
+};
+
+// Sum of items processed over chromosomes
+long sumItems(ChromosomeJobs &jobs,int n_chroms)
+{
+  long ret = 0;
+  for (int c = 0;c < n_chroms;c++) ret += jobs.items[c];
+  return ret;
+}
+
+// Empty copies of histogram, one per thread
+TH1 **makeThreadCopies(TH1 *his,int n_threads)
+{
+  TH1 **ret = new TH1*[n_threads];
+  for (int t = 0;t < n_threads;t++) {
+    ret[t] = (TH1*)his->Clone();
+    ret[t]->SetDirectory(0);
+    ret[t]->Reset();
+  }
+  return ret;
+}
+
+// Adds up copies to histogram and deletes copies
+void addThreadCopies(TH1 *his,TH1 **copies,int n_threads)
+{
+  for (int t = 0;t < n_threads;t++) {
+    his->Add(copies[t]);
+    delete copies[t];
+  }
+  delete[] copies;
+}
+
 HisMaker::HisMaker(string rootFile,Genome *genome) :
   root_file_name(rootFile),
-  inv_vals(NULL),sqrt_vals(NULL),tfuncs(NULL),
+  inv_vals(NULL),sqrt_vals(NULL),
   gen_his_signal(NULL),
   gen_his_distr(NULL),
   gen_his_distr_all(NULL),
   canv_view(NULL),
-  refGenome_(genome)
+  refGenome_(genome),
+  n_threads_(1),
+  write_rd_(false),
+  adaptive_bands_(false),
+  mask_tol_(0),
+  writer_(NULL),
+  writer_depth_(0),
+  metrics_(NULL),
+  fasta_(NULL),
+  gc_qc_(true)
 {}
 
 HisMaker::HisMaker(string rootFile,int binSize,bool useGCcorr,
@@ -58,7 +140,16 @@ HisMaker::HisMaker(string rootFile,int binSize,bool useGCcorr,
 				    _mean(0),    _sigma(0),
 				    _mean_all(0),_sigma_all(0),
 				    canv_view(NULL),
-				    refGenome_(genome)
+				    refGenome_(genome),
+				    n_threads_(1),
+				    write_rd_(false),
+				    adaptive_bands_(false),
+				    mask_tol_(0),
+				    writer_(NULL),
+				    writer_depth_(0),
+				    metrics_(NULL),
+				    fasta_(NULL),
+				    gc_qc_(true)
 {
   if (binSize <= 0) {
     cerr<<"Bin size "<<binSize<<" is not valid."<<endl;
@@ -107,24 +198,20 @@ HisMaker::HisMaker(string rootFile,int binSize,bool useGCcorr,
   dl2      = new TH2D("dl2" + suff,"Delta RD level",
 		      601,-300.5,300.5,601,-300.5,300.5);
   
-  // Precalculating inverse
+  // Precalculating inverse and sqrt; tables are only read afterwards, so
+  // they can be used from several threads
   inv_vals = new double[N_INV];
-  for (int i = 0;i < N_INV;i++) inv_vals[i] = 0;
-  
-  // recalculating sqrt
+  inv_vals[0] = 0;
+  for (int i = 1;i < N_INV;i++) inv_vals[i] = 1./i;
   sqrt_vals = new double[N_SQRT];
-  for (int i = 0;i < N_SQRT;i++) sqrt_vals[i] = 0;
-  
-  // Allocating t-cumulative functions
-  tfuncs = new TF1*[N_FUNC];
-  for (int i = 0;i < N_FUNC;i++) tfuncs[i] = NULL;
+  for (int i = 0;i < N_SQRT;i++) sqrt_vals[i] = TMath::Sqrt(i);
 }
 
 HisMaker::~HisMaker()
 {
+  delete writer_;
   delete[] inv_vals;
   delete[] sqrt_vals;
-  delete[] tfuncs;
 }
 
 TH1* HisMaker::getHistogram(TString name)
@@ -134,35 +221,71 @@ TH1* HisMaker::getHistogram(TString name)
 
 TH1* HisMaker::getHistogram(TString name,TString rfile,TString dir)
 {
-  TFile file(rfile);
-  if (file.IsZombie()) {
+  TH1 *ret = cache_.get(rfile,dir,name);
+  if (ret) return ret;
+
+  if (writer_ && writer_->fileName() == rfile) {
+    ret = writer_->get(dir,name);
+    if (ret) cache_.put(rfile,dir,name,ret);
+    return ret;
+  }
+
+  TFile *file = cache_.getFile(rfile);
+  if (!file) {
     cerr<<"Can't open file '"<<rfile<<"'."<<endl;
     return NULL;
   }
   TDirectory *d = NULL;
   if (dir.Length() > 0) {
-    d = (TDirectory*)file.Get(dir);
+    d = (TDirectory*)file->Get(dir);
     if (!d) {
       cerr<<"Can't find directory '"<<dir<<"'."<<endl;
       return NULL;
     }
-    d->cd();
-  } else d = &file;
+  } else d = file;
   TH1 *his = (TH1*)d->Get(name);
   if (!his) return NULL;
   
   gROOT->cd();
-  TH1 *ret = (TH1*)his->Clone(name);
-  
-  file.Close();
+  ret = (TH1*)his->Clone(name);
+  delete his; // Only cached copy is kept
+  cache_.put(rfile,dir,name,ret);
   
   return ret;
 }
 
+void HisMaker::beginOutput()
+{
+  if (writer_depth_++ > 0) return;
+  cache_.closeFile(root_file_name); // Reading through writer instead
+  writer_ = new HisWriter(root_file_name);
+}
+
+void HisMaker::endOutput()
+{
+  if (writer_depth_ <= 0 || --writer_depth_ > 0) return;
+  delete writer_;
+  writer_ = NULL;
+}
+
 bool HisMaker::writeH(bool useDir,
 		      TH1 *his1,TH1 *his2,TH1 *his3,
 		      TH1 *his4,TH1 *his5,TH1 *his6)
 {
+  TString dir_written = useDir ? dir_name : "";
+  TH1 *hiss[6] = {his1,his2,his3,his4,his5,his6};
+  for (int i = 0;i < 6;i++)
+    if (hiss[i]) cache_.remove(root_file_name,dir_written,hiss[i]->GetName());
+
+  if (writer_ && writer_->fileName() == root_file_name) {
+    bool ret = true;
+    for (int i = 0;i < 6;i++)
+      if (!writer_->add(dir_written,hiss[i])) ret = false;
+    return ret;
+  }
+
+  cache_.closeFile(root_file_name); // Handle would not see the changes
+
   TFile file(root_file_name,"Update");
   if (file.IsZombie()) {
     cerr<<"Can't open file '"<<root_file_name<<"'."<<endl;
@@ -199,7 +322,6 @@ double HisMaker::getInverse(int n)
 {
   if (n <= 0) return 0;
   if (n >= N_INV) return 1./n;
-  if (inv_vals[n] == 0) inv_vals[n] = 1./n;
   return inv_vals[n];
 }
 
@@ -207,50 +329,41 @@ double HisMaker::getSqrt(int n)
 {
   if (n <= 0) return 0;
   if (n >= N_SQRT) return TMath::Sqrt(n);
-  if (sqrt_vals[n] == 0) sqrt_vals[n] = TMath::Sqrt(n);
   return sqrt_vals[n];
 }
 
-TF1 *HisMaker::getTFunction(int n)
+// Cumulative t-distribution with n degrees of freedom. Called directly,
+// rather than through TF1, so it can be used from several threads. From
+// N_T_NORMAL degrees of freedom on (large regions), normal approximation of
+// Wallace (1959) replaces incomplete beta function; relative error of tails
+// is below 1e-4 and falls as square of degrees of freedom.
+double HisMaker::tCDF(double x,int n)
 {
-  if (n < 1) return NULL;
-  if (n >= N_FUNC || tfuncs[n] == NULL) {
-    TString desc = "ROOT::Math::tdistribution_cdf(x,";
-    desc += n; desc += ")";
-    TString name = "tcum_";name += n;
-    TF1 *f = new TF1(name.Data(),desc.Data(),-100,100);
-    if (n < N_FUNC) tfuncs[n] = f;
-    return f;
-  }
-  return tfuncs[n];
+  if (n < N_T_NORMAL) return ROOT::Math::tdistribution_cdf(x,n);
+  double z = (8.*n + 1)/(8.*n + 3)*TMath::Sqrt(n*log1p(x*x/n));
+  double tail = 0.5*TMath::Erfc(z*M_SQRT1_2);
+  return (x < 0) ? tail : 1 - tail;
 }
 
-void HisMaker::getAverageVariance(double *rd,int start,int stop,
+void HisMaker::getAverageVariance(SegmentStats &rd,int start,int stop,
 				  double &average,double &variance,int &n)
 {
-  average = variance = 0;
-  n = 0;
-  for (int b = start;b <= stop;b++) {
-    average  += rd[b];
-    variance += rd[b]*rd[b];
-    n++;
-  }
+  n = (stop >= start) ? stop - start + 1 : 0;
   double over_n = 1./n;
-  average *= over_n;
-  variance = variance*over_n - average*average;
+  average  = rd.sum(start,stop)*over_n;
+  variance = rd.variance(start,stop);
 }
 
 double HisMaker::testRegion(double value,double m,double s,int n)
 {
   if (s == 0) s = 1;
   
-  TF1 *cum_t = getTFunction(n - 1);
-  if (cum_t == NULL) {
+  if (n - 1 < 1) {
     cerr<<"4: Can't find proper t-function."<<endl;
     return 1;
   }
   double x = (value - m)/sqrt(s)*getSqrt(n);
-  double p = cum_t->Eval(x); if (x > 0) p = 1 - p;
+  double p = tCDF(x,n - 1); if (x > 0) p = 1 - p;
   return p;
 }
 
@@ -267,12 +380,11 @@ double HisMaker::testTwoRegions(double m1,double s1,int n1,
   tmp /= tmp1*tmp1*(n2 - 1) + tmp2*tmp2*(n1 - 1);
   int ndf = int(tmp + 0.5);
   
-  TF1* cum_t = getTFunction(ndf);
-  if (cum_t == NULL) {
+  if (ndf < 1) {
     cerr<<"2: Can't find proper t-function."<<endl;
     return 1;
   }
-  double ret = cum_t->Eval(t);
+  double ret = tCDF(t,ndf);
   if (t > 0) ret = 1 - ret;
   
   ret *= scale*inv_bin_size*getInverse(n1 + n2);
@@ -280,24 +392,19 @@ double HisMaker::testTwoRegions(double m1,double s1,int n1,
   return ret;
 }
 
-double HisMaker::getEValue(double mean,double sigma,double *rd,
+double HisMaker::getEValue(double mean,double sigma,SegmentStats &rd,
 			   int start,int end)
 {
   int n = end - start + 1;
-  double aver = 0,s = 0, over_n = 1./n;
-  for (int b = start;b <= end;b++) {
-    aver  += rd[b];
-    s += rd[b]*rd[b];
-  }
-  aver *= over_n;
-  s = TMath::Sqrt(s*over_n - aver*aver);
+  double over_n = 1./n;
+  double aver = rd.sum(start,end)*over_n;
+  double s = TMath::Sqrt(rd.variance(start,end));
   
   if (s == 0) s = sigma*TMath::Sqrt(aver/mean);
   if (s == 0) s = 1;
   
-  TF1* cum = getTFunction(n - 1);
   double x = (aver - mean)*getSqrt(n)/s;
-  double ret = cum->Eval(x);
+  double ret = tCDF(x,n - 1);
   
   if (x > 0) ret = 1 - ret;
   ret *= GENOME_SIZE_NORMAL*inv_bin_size*getInverse(end - start + 1);
@@ -320,16 +427,6 @@ bool HisMaker::getRegionLeft(double *level,int n_bins,int bin,
   return true;
 }
 
-bool HisMaker::getRegionRight(double *level,int n_bins,int bin,
-			      int &start,int &stop)
-{
-  if (bin < 0 || bin >= n_bins) return false;
-  start = bin; stop = start;
-  while (stop < n_bins && sameLevel(level[start],level[stop])) stop++;
-  stop--;
-  return true;
-}
-
 void HisMaker::view(string *files,int n_files,bool useATcorr,bool useGCcorr)
 {
   TTimer  *timer = new TTimer("gSystem->ProcessEvents();",50,kFALSE);
@@ -561,7 +658,7 @@ int HisMaker::extract_pe(TString input,
     qual_hash.clear();
     for (int f = 0;f < n_bams;f++) {
       if (do_print) cout<<"\t"<<bams[f]<<endl;
-      AliParser *parser = new AliParser(bams[f].c_str(),true);
+      AliParser *parser = new AliParser(bams[f].c_str(),true,n_threads_);
       int chr_index = parser->scrollTo(chrom.Data(),srange);
       if (chr_index < 0) {
 	chrom.ToUpper();
@@ -730,8 +827,8 @@ void HisMaker::drawHistograms(TString chrom,int start,int end,
   line1->Draw(); line2->Draw();
 }
 
-bool HisMaker::adjustToEValue(double mean,double sigma,double *rd,int n_bins,
-			      int &start,int &end,double eval)
+bool HisMaker::adjustToEValue(double mean,double sigma,SegmentStats &rd,
+			      int n_bins,int &start,int &end,double eval)
 {
   static const int MAX_STEPS = 1000;
   int s0 = start, e0 = end;
@@ -783,19 +880,15 @@ bool HisMaker::adjustToEValue(double mean,double sigma,double *rd,int n_bins,
   return false;
 }
 
-double HisMaker::gaussianEValue(double mean,double sigma,double *rd,
+double HisMaker::gaussianEValue(double mean,double sigma,SegmentStats &rd,
 				int start,int end)
 {
   // Calculate by deviation from gaussian
-  double max = 0,min = 1e+10,av = 0;
+  double max = rd.max(start,end),min = rd.min(start,end);
+  if (max < 0)     max = 0;
+  if (min > 1e+10) min = 1e+10;
   int n = end - start + 1;
-  for (int i = start;i <= end;i++) {
-    av += rd[i];
-    if (rd[i] > max) max = rd[i];
-    if (rd[i] < min) min = rd[i];
-  }
-    
-  av *= getInverse(n);
+  double av = rd.sum(start,end)*getInverse(n);
 
   double p = 0;
   if (av < mean) {
@@ -808,6 +901,68 @@ double HisMaker::gaussianEValue(double mean,double sigma,double *rd,
   return GENOME_SIZE_NORMAL*TMath::Power(p,n);
 }
 
+// Fewer regions per thread are not worth starting threads for
+static const int MIN_REGION_BATCH = 64;
+
+// Regions of one chromosome refined to e-value cutoff, or evaluated for
+// calls, by threads in callSVs(). Each job does a batch of regions, and
+// result for a region does not depend on others, so calls are the same for
+// any number of threads.
+struct RegionJobs
+{
+  HisMaker     *maker;
+  SegmentStats *rd;
+  double        mean,sigma;
+  int           n_bins,n,batch,add;
+  int          *start,*end; // Refined in place
+  bool         *ok;         // Region is within e-value cutoff
+  double       *e,*e2,*e3,*e4;
+};
+
+void HisMaker::runRegionJobs(ThreadPool::Task task,RegionJobs *regions,
+			     int n_threads)
+{
+  int n = regions->n;
+  regions->batch = (n + n_threads - 1)/n_threads;
+  if (regions->batch < MIN_REGION_BATCH) regions->batch = MIN_REGION_BATCH;
+  int n_jobs = (n + regions->batch - 1)/regions->batch;
+  if (n_threads > 1 && n_jobs > 1) {
+    ThreadPool pool(n_threads);
+    pool.run(task,regions,n_jobs);
+  } else
+    for (int j = 0;j < n_jobs;j++) task(j,0,regions);
+}
+
+void HisMaker::refineRegionsJob(int job,int thread,void *arg)
+{
+  RegionJobs *r = (RegionJobs*)arg;
+  int first = job*r->batch,last = first + r->batch;
+  if (last > r->n) last = r->n;
+  for (int i = first;i < last;i++)
+    r->ok[i] = r->maker->adjustToEValue(r->mean,r->sigma,*r->rd,r->n_bins,
+					r->start[i],r->end[i],CUTOFF_REGION);
+}
+
+void HisMaker::evaluateRegionsJob(int job,int thread,void *arg)
+{
+  RegionJobs *r = (RegionJobs*)arg;
+  HisMaker *maker = r->maker;
+  int first = job*r->batch,last = first + r->batch;
+  if (last > r->n) last = r->n;
+  for (int i = first;i < last;i++) {
+    int bs = r->start[i],be = r->end[i];
+    r->e[i]  = maker->getEValue(r->mean,r->sigma,*r->rd,bs,be);
+    r->e2[i] = maker->gaussianEValue(r->mean,r->sigma,*r->rd,bs,be);
+    r->e3[i] = r->e4[i] = 1;
+    if (bs + r->add < be - r->add) {
+      r->e3[i] = maker->getEValue(r->mean,r->sigma,*r->rd,
+				  bs + r->add,be - r->add);
+      r->e4[i] = maker->gaussianEValue(r->mean,r->sigma,*r->rd,
+				       bs + r->add,be - r->add);
+    }
+  }
+}
+
 void HisMaker::callSVs(string *user_chroms,int n_chroms,
 		       bool useATcorr,bool useGCcorr,bool relax)
 {
@@ -829,215 +984,327 @@ void HisMaker::callSVs(string *user_chroms,int n_chroms,
     return;
   }
 
-  for (int c = 0;c < n_chroms;c++) {
-    string chrom   = user_chroms[c];
-    string name    = Genome::makeCanonical(chrom);
-    TH1 *h_unique  = getHistogram(getUSignalName(name,bin_size));
-    TH1 *h_all     = getHistogram(getSignalName(name,bin_size,false,false));
-    TH1 *his       = getHistogram(getSignalName(name,bin_size,
-						useATcorr,useGCcorr));
-    TH1 *partition = getHistogram(getPartitionName(name,bin_size,
-						   useATcorr,useGCcorr));
-    TH1 *rd_his    = getHistogram(getDistrName(name,bin_size,
-					       useATcorr,useGCcorr));
-    TH1 *rd_his_global = getHistogram(getDistrName(chrAll,bin_size,
-						   useATcorr,useGCcorr));
-    if (!his || !rd_his || !partition) {
-      cerr<<his<<endl;
-      cerr<<getSignalName(name,bin_size,useATcorr,useGCcorr)<<endl;
-      cerr<<rd_his<<endl;
-      cerr<<partition<<endl;
-      cerr<<"Can't find all histograms for '"<<chrom<<"'."<<endl;
-      return;
-    }
-    
-    TString hname = partition->GetName();
-    TH1 *merge = (TH1*)partition->Clone(hname + "_merge");
-    
-    double mean,sigma;
-    getMeanSigma(rd_his,mean,sigma);
-    
-    int n_bins = partition->GetNbinsX();
-    double *level = new double[n_bins],*rd = new double[n_bins];
-    char   *flags = new char[n_bins];
-    for (int b = 0;b < n_bins;b++) {
-      rd[b]    = his->GetBinContent(b + 1);
-      level[b] = partition->GetBinContent(b + 1);
-      flags[b] = ' ';
-    }
-
-    double cut = mean/4;
-    if (rd_his_global) {
-      double mean_global,sigma_global;
-      getMeanSigma(rd_his_global,mean_global,sigma_global);
-      if (mean < 0.66*mean_global) { // For male individuals
-	cerr<<"Assuming male individual!"<<endl;
-	cut = mean/2;
-      }
-    }
-    if (relax) cut /= 2;
+  Metrics::Mark start = Metrics::mark();
+  ThreadPool pool(n_threads_);
+  int n_threads = pool.numThreads();
+  ChromosomeJobs jobs = ChromosomeJobs();
+  jobs.maker     = this;
+  jobs.pool      = &pool;
+  jobs.chroms    = user_chroms;
+  jobs.useATcorr = useATcorr;
+  jobs.useGCcorr = useGCcorr;
+  jobs.relax     = relax;
+  jobs.region_threads = n_threads/(n_chroms < n_threads ? n_chroms : n_threads);
+  jobs.rd_level_merge = makeThreadCopies(rd_level_merge,n_threads);
+  jobs.calls     = new string[n_chroms];
+  jobs.items     = new long[n_chroms]();
+  beginOutput();
+  pool.run(callSVsJob,&jobs,n_chroms);
+
+  for (int c = 0;c < n_chroms;c++) cout<<jobs.calls[c];
+  delete[] jobs.calls;
+
+  addThreadCopies(rd_level_merge,jobs.rd_level_merge,n_threads);
+  writeHistogramsToBinDir(rd_level_merge);
+  endOutput();
+  if (metrics_)
+    metrics_->record("call","total","",start,sumItems(jobs,n_chroms));
+  delete[] jobs.items;
+}
 
-    while (mergeLevels(level,n_bins,cut)) ;
-    
-  //     for (int b = 0;b < n_bins;b++)
-  //       merge->SetBinContent(b + 1,level[b]);
+void HisMaker::callSVsJob(int job,int thread,void *arg)
+{
+  ChromosomeJobs *jobs = (ChromosomeJobs*)arg;
+  jobs->maker->callSVsChromosome(jobs,job,thread);
+}
 
-    // Initial region identification
-    double min = mean - cut;
-    double max = mean + cut;
-    for (int b = 0;b < n_bins;b++) {
-      int b0 = b;
-      int bs = b;
-      while (b < n_bins && level[b] < min) b++;
-      int be = b - 1;
-      if (be > bs && adjustToEValue(mean,sigma,rd,n_bins,bs,be,CUTOFF_REGION))
-	for (int i = bs;i <= be;i++) flags[i] = 'D';
-      bs = b;
-      while (b < n_bins && level[b] > max) b++;
-      be = b - 1;
-      if (be > bs && adjustToEValue(mean,sigma,rd,n_bins,bs,be,CUTOFF_REGION))
-	for (int i = bs;i <= be;i++) flags[i] = 'A';
-      if (b > b0) b--;
+void HisMaker::callSVsChromosome(ChromosomeJobs *jobs,int job,int thread)
+{
+  ThreadPool *pool = jobs->pool;
+  bool useATcorr = jobs->useATcorr,useGCcorr = jobs->useGCcorr;
+  string chrom = jobs->chroms[job];
+  string name  = Genome::makeCanonical(chrom);
+  Metrics::Mark start = Metrics::mark(true),phase;
+
+  pool->lock();
+  TH1 *h_unique  = getHistogram(getUSignalName(name,bin_size));
+  TH1 *h_all     = getHistogram(getSignalName(name,bin_size,false,false));
+  TH1 *his       = getHistogram(getSignalName(name,bin_size,
+					      useATcorr,useGCcorr));
+  TH1 *partition = getHistogram(getPartitionName(name,bin_size,
+						 useATcorr,useGCcorr));
+  TH1 *rd_his    = getHistogram(getDistrName(name,bin_size,
+					     useATcorr,useGCcorr));
+  TH1 *rd_his_global = getHistogram(getDistrName(chrAll,bin_size,
+						 useATcorr,useGCcorr));
+  TH1 *his_segments  = getHistogram(getSegmentsName(name,bin_size,
+						    useATcorr,useGCcorr));
+  if (!his || !rd_his || !partition) {
+    cerr<<his<<endl;
+    cerr<<getSignalName(name,bin_size,useATcorr,useGCcorr)<<endl;
+    cerr<<rd_his<<endl;
+    cerr<<partition<<endl;
+    cerr<<"Can't find all histograms for '"<<chrom<<"'."<<endl;
+    delete h_unique;
+    delete h_all;
+    delete his;
+    delete partition;
+    delete rd_his;
+    delete rd_his_global;
+    delete his_segments;
+    pool->unlock();
+    return;
+  }
+  
+  TString hname = partition->GetName();
+  TH1 *merge = (TH1*)partition->Clone(hname + "_merge");
+  
+  double mean,sigma;
+  getMeanSigma(rd_his,mean,sigma);
+  
+  int n_bins = partition->GetNbinsX();
+  double *level = new double[n_bins],*rd = new double[n_bins];
+  char   *flags = new char[n_bins];
+  for (int b = 0;b < n_bins;b++) {
+    rd[b]    = his->GetBinContent(b + 1);
+    level[b] = partition->GetBinContent(b + 1);
+    flags[b] = ' ';
+  }
+
+  double cut = mean/4;
+  if (rd_his_global) {
+    double mean_global,sigma_global;
+    getMeanSigma(rd_his_global,mean_global,sigma_global);
+    if (mean < 0.66*mean_global) { // For male individuals
+      cerr<<"Assuming male individual!"<<endl;
+      cut = mean/2;
     }
-    
-    // Merging with short regions
-    int n_add = 1;
-    while (n_add > 0) {
-      for (int b = 0;b < n_bins;b++) {
+  }
+  if (jobs->relax) cut /= 2;
+
+  // Segments written by partition; found from levels for older files
+  Segments segments;
+  if (his_segments && !segments.read(his_segments,level,n_bins))
+    cerr<<"Segments don't match partition for '"<<chrom<<"'."<<endl;
+
+  delete his;
+  delete partition;
+  delete rd_his;
+  delete rd_his_global;
+  delete his_segments;
+  pool->unlock();
+  SegmentStats rd_stats(rd,n_bins);
+
+  phase = Metrics::mark(true);
+  mergeLevels(level,n_bins,cut,segments);
+  segments.setStats(rd_stats);
+  if (metrics_) metrics_->record("call","merge",chrom,phase,segments.size());
+  
+//     for (int b = 0;b < n_bins;b++)
+//       merge->SetBinContent(b + 1,level[b]);
+
+  // Initial region identification. Candidate regions are collected first,
+  // refined on several threads, and flagged in order they were found
+  RegionJobs regions = RegionJobs();
+  regions.maker = this;
+  regions.rd    = &rd_stats;
+  regions.mean  = mean;
+  regions.sigma = sigma;
+  regions.n_bins = n_bins;
+  regions.add   = int(1000./bin_size + 0.5);
+  regions.start = new int[n_bins];
+  regions.end   = new int[n_bins];
+  regions.ok    = new bool[n_bins];
+  char *types   = new char[n_bins];
+  double min = mean - cut;
+  double max = mean + cut;
+  for (int b = 0;b < n_bins;b++) {
+    int b0 = b;
+    int bs = b;
+    while (b < n_bins && level[b] < min) b++;
+    int be = b - 1;
+    if (be > bs) {
+      regions.start[regions.n] = bs;
+      regions.end[regions.n]   = be;
+      types[regions.n++] = 'D';
+    }
+    bs = b;
+    while (b < n_bins && level[b] > max) b++;
+    be = b - 1;
+    if (be > bs) {
+      regions.start[regions.n] = bs;
+      regions.end[regions.n]   = be;
+      types[regions.n++] = 'A';
+    }
+    if (b > b0) b--;
+  }
+  phase = Metrics::mark(true);
+  runRegionJobs(refineRegionsJob,&regions,jobs->region_threads);
+  if (metrics_) metrics_->record("call","refine",chrom,phase,regions.n);
+  for (int r = 0;r < regions.n;r++)
+    if (regions.ok[r])
+      for (int i = regions.start[r];i <= regions.end[r];i++) flags[i] = types[r];
+  
+  // Merging with short regions
+  int n_add = 1;
+  while (n_add > 0) {
+    for (int b = 0;b < n_bins;b++) {
 	
-	if (flags[b] != ' ') continue;
+      if (flags[b] != ' ') continue;
 	
-	int s = b;
-	while (b < n_bins && flags[b] == ' ') b++;
-	int e = b - 1;
+      int s = b;
+      while (b < n_bins && flags[b] == ' ') b++;
+      int e = b - 1;
 	
-	if (e < s || s == 0 || e >= n_bins) continue;
-	if (flags[s - 1] != flags[e + 1]) continue;
-	if (s == e) { flags[s] = flags[s - 1]; continue; }
+      if (e < s || s == 0 || e >= n_bins) continue;
+      if (flags[s - 1] != flags[e + 1]) continue;
+      if (s == e) { flags[s] = flags[s - 1]; continue; }
 	
-	int le = s - 1,ls = le;
-	while (ls >= 0 && flags[ls] == flags[le]) ls--; ls++;
-	int rs = e + 1,re = rs;
-	while (re < n_bins && flags[re] == flags[rs]) re++; re--;
+      int le = s - 1,ls = le;
+      while (ls >= 0 && flags[ls] == flags[le]) ls--; ls++;
+      int rs = e + 1,re = rs;
+      while (re < n_bins && flags[re] == flags[rs]) re++; re--;
 	
-	double average,variance;
-	double raverage,rvariance;
-	double laverage,lvariance;
-	int n,rn,ln;
-	getAverageVariance(rd, s, e, average, variance, n);
-	getAverageVariance(rd,rs,re,raverage,rvariance,rn);
-	getAverageVariance(rd,ls,le,laverage,lvariance,ln);
-	if (n > rn || n > ln) continue;
+      double average,variance;
+      double raverage,rvariance;
+      double laverage,lvariance;
+      int n,rn,ln;
+      getAverageVariance(rd_stats, s, e, average, variance, n);
+      getAverageVariance(rd_stats,rs,re,raverage,rvariance,rn);
+      getAverageVariance(rd_stats,ls,le,laverage,lvariance,ln);
+      if (n > rn || n > ln) continue;
 	
-	if (testTwoRegions(laverage,lvariance,ln,average,variance,n,
-			   GENOME_SIZE_CNV) < CUTOFF_TWO_REGIONS &&
-	    testTwoRegions(raverage,rvariance,rn,average,variance,n,
-			   GENOME_SIZE_CNV) < CUTOFF_TWO_REGIONS)
-	  continue;
+      if (testTwoRegions(laverage,lvariance,ln,average,variance,n,
+			 GENOME_SIZE_CNV) < CUTOFF_TWO_REGIONS &&
+	  testTwoRegions(raverage,rvariance,rn,average,variance,n,
+			 GENOME_SIZE_CNV) < CUTOFF_TWO_REGIONS)
+	continue;
 	
-	for (int i = s;i <= e;i++) flags[i] = 'C';
-      }
-      
-      n_add = 0;
-      for (int i = 0;i <= n_bins;i++) 
-	if (flags[i] == 'C') {
-	  flags[i] = flags[i - 1];
-	  n_add++;
-	}
+      for (int i = s;i <= e;i++) flags[i] = 'C';
     }
     
-    // Additional deletions
-    for (int b = 0;b < n_bins;b++) {
-      if (flags[b] != ' ') continue;
-      int bs = b;
-      while (b < n_bins && level[b] < min) b++;
-      int be = b - 1;
-      if (be > bs) {
-	if (gaussianEValue(mean,sigma,rd,bs,be) < CUTOFF_REGION)
-	  for (int i = bs;i <= be;i++) flags[i] = 'd';
-	b--;
+    n_add = 0;
+    for (int i = 0;i <= n_bins;i++) 
+      if (flags[i] == 'C') {
+	flags[i] = flags[i - 1];
+	n_add++;
       }
-    }
-    
-    // Additional duplications
-    //     for (int b = 0;b < n_bins;b++) {
-    //       if (flags[b] != ' ') continue;
-    //       int bs = b;
-    //       while (b < n_bins && level[b] > max) b++;
-    //       int be = b - 1;
-    //       if (be > bs) {
-    // 	if (gaussianEValue(mean,sigma,rd,bs,be) < CUTOFF_REGION)
-    //  	  for (int i = bs;i <= be;i++) flags[i] = 'a';
-    // 	b--;
-    //       }
-    //     }
-    
-    // Filling and saving histograms
-    for (int b = 0;b < n_bins;b++) {
-      int b0 = b, n = 0;
-      double lev = 0,tmp = level[b];
-      while (b < n_bins && sameLevel(level[b],tmp)) { lev += rd[b]; n++; b++; }
-      lev *= getInverse(n);
-      rd_level_merge->Fill(lev);
+  }
+  
+  // Additional deletions
+  for (int b = 0;b < n_bins;b++) {
+    if (flags[b] != ' ') continue;
+    int bs = b;
+    while (b < n_bins && level[b] < min) b++;
+    int be = b - 1;
+    if (be > bs) {
+      if (gaussianEValue(mean,sigma,rd_stats,bs,be) < CUTOFF_REGION)
+	for (int i = bs;i <= be;i++) flags[i] = 'd';
       b--;
     }
-    
-    for (int b = 0;b < n_bins;b++) {
-      int b0 = b, n = 0;
-      char c = flags[b];
-      double lev = 0;
-      while (b < n_bins  && flags[b] == c) { lev += rd[b]; n++; b++; }
-      lev *= getInverse(n);
-      while (b0 < b) {
-	level[b0++] = lev;
-	merge->SetBinContent(b0,lev);
-      }
-      b--;
+  }
+  
+  // Additional duplications
+  //     for (int b = 0;b < n_bins;b++) {
+  //       if (flags[b] != ' ') continue;
+  //       int bs = b;
+  //       while (b < n_bins && level[b] > max) b++;
+  //       int be = b - 1;
+  //       if (be > bs) {
+  // 	if (gaussianEValue(mean,sigma,rd,bs,be) < CUTOFF_REGION)
+  //  	  for (int i = bs;i <= be;i++) flags[i] = 'a';
+  // 	b--;
+  //       }
+  //     }
+  
+  // Filling and saving histograms
+  for (int i = 0;i < segments.size();i++)
+    jobs->rd_level_merge[thread]->Fill(segments[i].sum*
+				       getInverse(segments[i].n));
+  
+  for (int b = 0;b < n_bins;b++) {
+    int b0 = b, n = 0;
+    char c = flags[b];
+    double lev = 0;
+    while (b < n_bins  && flags[b] == c) { lev += rd[b]; n++; b++; }
+    lev *= getInverse(n);
+    while (b0 < b) {
+      level[b0++] = lev;
+      merge->SetBinContent(b0,lev);
     }
-    
-    writeHistogramsToBinDir(rd_level_merge,merge);
-
-    // Making calls
-    for (int b = 0;b < n_bins;b++) {
-      char c = flags[b];
-      if (c == ' ') continue;
-      int bs = b;
-      double cnv = 0;
-      while (b < n_bins && flags[b] == c) cnv += rd[b++];
-      int be = --b;
-      
-      if (be <= bs) continue;
-      
-      cnv /= (be - bs + 1)*mean;
-      TString type = "???";
-      if (c == 'D' || c == 'd')      type = "deletion";
-      else if (c == 'A' || c == 'a') type = "duplication";
-      int start  = bs*bin_size + 1;
-      int end    = (be + 1)*bin_size;
-      double size = end - start + 1;
-      double e  = getEValue(mean,sigma,rd,bs,be);
-      double e2 = gaussianEValue(mean,sigma,rd,bs,be);
-      double e3 = 1,e4 = 1;
-      int add = int(1000./bin_size + 0.5);
-      if (bs + add < be - add) {
-	e3 = getEValue(mean,sigma,rd,bs + add,be - add);
-	e4 = gaussianEValue(mean,sigma,rd,bs + add,be - add);
-      }
-      double n_reads_all = 0,n_reads_unique = 0;
-      for (int i = bs;i <= be;i++) {
-	n_reads_all    += h_all->GetBinContent(i);
-	n_reads_unique += h_unique->GetBinContent(i);
-      }
-      double q0 = -1;
-      if (n_reads_all > 0) q0 = (n_reads_all - n_reads_unique)/n_reads_all;
-      cout<<type<<"\t"<<chrom<<":"<<start<<"-"<<end<<"\t"
-	  <<size<<"\t"<<cnv<<"\t"<<e<<"\t"<<e2<<"\t"
-	  <<e3<<"\t"<<e4<<"\t"<<q0<<endl;
+    b--;
+  }
+  
+  pool->lock();
+  writeHistogramsToBinDir(merge);
+  delete merge;
+  pool->unlock();
+
+  // Making calls; e-values of all calls are calculated on several threads,
+  // calls are printed in order of chromosomes once all are done
+  regions.n = 0;
+  for (int b = 0;b < n_bins;b++) {
+    char c = flags[b];
+    if (c == ' ') continue;
+    int bs = b;
+    while (b < n_bins && flags[b] == c) b++;
+    int be = --b;
+    if (be <= bs) continue;
+    regions.start[regions.n] = bs;
+    regions.end[regions.n]   = be;
+    types[regions.n++] = c;
+  }
+  regions.e  = new double[regions.n];
+  regions.e2 = new double[regions.n];
+  regions.e3 = new double[regions.n];
+  regions.e4 = new double[regions.n];
+  phase = Metrics::mark(true);
+  runRegionJobs(evaluateRegionsJob,&regions,jobs->region_threads);
+  if (metrics_) metrics_->record("call","evaluate",chrom,phase,regions.n);
+
+  ostringstream calls;
+  for (int r = 0;r < regions.n;r++) {
+    char c = types[r];
+    int bs = regions.start[r],be = regions.end[r];
+    double cnv = 0;
+    for (int i = bs;i <= be;i++) cnv += rd[i];
+    cnv /= (be - bs + 1)*mean;
+    TString type = "???";
+    if (c == 'D' || c == 'd')      type = "deletion";
+    else if (c == 'A' || c == 'a') type = "duplication";
+    int start  = bs*bin_size + 1;
+    int end    = (be + 1)*bin_size;
+    double size = end - start + 1;
+    double n_reads_all = 0,n_reads_unique = 0;
+    for (int i = bs;i <= be;i++) {
+      n_reads_all    += h_all->GetBinContent(i);
+      n_reads_unique += h_unique->GetBinContent(i);
     }
-    delete[] rd;
-    delete[] level;
-    delete[] flags;
+    double q0 = -1;
+    if (n_reads_all > 0) q0 = (n_reads_all - n_reads_unique)/n_reads_all;
+    calls<<type<<"\t"<<chrom<<":"<<start<<"-"<<end<<"\t"
+	 <<size<<"\t"<<cnv<<"\t"<<regions.e[r]<<"\t"<<regions.e2[r]<<"\t"
+	 <<regions.e3[r]<<"\t"<<regions.e4[r]<<"\t"<<q0<<endl;
   }
+  delete[] regions.start;
+  delete[] regions.end;
+  delete[] regions.ok;
+  delete[] regions.e;
+  delete[] regions.e2;
+  delete[] regions.e3;
+  delete[] regions.e4;
+  delete[] types;
+  delete[] rd;
+  delete[] level;
+  delete[] flags;
+  jobs->calls[job] = calls.str();
+
+  pool->lock();
+  delete h_all;
+  delete h_unique;
+  pool->unlock();
+  jobs->items[job] = n_bins;
+  if (metrics_) metrics_->record("call","chromosome",chrom,start,n_bins);
 }
 
 void HisMaker::getMeanSigma(TH1 *his,double &mean,double &sigma)
@@ -1133,120 +1400,215 @@ void HisMaker::partition(string *user_chroms,int n_chroms,
     return;
   }
 
-  for (int c = 0;c < n_chroms;c++) {
-    string chrom = user_chroms[c];
-    string name = Genome::makeCanonical(chrom);
-    TH1 *his    = getHistogram(getSignalName(name,bin_size,
-					     useATcorr,useGCcorr));
-    TH1 *rd_his = getHistogram(getDistrName(name,bin_size,
-					    useATcorr,useGCcorr));
-    if (!his || !rd_his) {
-      cerr<<"Can't find all histograms for '"<<chrom<<"'."<<endl;
-      return;
-    }
+  Metrics::Mark start = Metrics::mark();
+  ThreadPool pool(n_threads_);
+  int n_threads = pool.numThreads();
+  ChromosomeJobs jobs = ChromosomeJobs();
+  jobs.maker      = this;
+  jobs.pool       = &pool;
+  jobs.chroms     = user_chroms;
+  jobs.useATcorr  = useATcorr;
+  jobs.useGCcorr  = useGCcorr;
+  jobs.skipMasked = skipMasked;
+  jobs.range      = range;
+  // Threads left idle by chromosomes go to calculating levels
+  jobs.level_threads = n_threads/(n_chroms < n_threads ? n_chroms : n_threads);
+  jobs.rd_level   = makeThreadCopies(rd_level,n_threads);
+  jobs.frag_len   = makeThreadCopies(frag_len,n_threads);
+  jobs.dl         = makeThreadCopies(dl,n_threads);
+  jobs.dl2        = makeThreadCopies(dl2,n_threads);
+  jobs.items      = new long[n_chroms]();
+  beginOutput();
+  pool.run(partitionJob,&jobs,n_chroms);
+
+  // General statistics
+  addThreadCopies(rd_level,jobs.rd_level,n_threads);
+  addThreadCopies(frag_len,jobs.frag_len,n_threads);
+  addThreadCopies(dl,      jobs.dl,      n_threads);
+  addThreadCopies(dl2,     jobs.dl2,     n_threads);
+  writeHistogramsToBinDir(rd_level,frag_len,dl,dl2);
+  endOutput();
+  if (metrics_)
+    metrics_->record("partition","total","",start,sumItems(jobs,n_chroms));
+  delete[] jobs.items;
+}
+
+void HisMaker::partitionJob(int job,int thread,void *arg)
+{
+  ChromosomeJobs *jobs = (ChromosomeJobs*)arg;
+  jobs->maker->partitionChromosome(jobs,job,thread);
+}
+
+void HisMaker::partitionChromosome(ChromosomeJobs *jobs,int job,int thread)
+{
+  ThreadPool *pool = jobs->pool;
+  bool useATcorr = jobs->useATcorr,useGCcorr = jobs->useGCcorr;
+  bool skipMasked = jobs->skipMasked;
+  string chrom = jobs->chroms[job];
+  string name = Genome::makeCanonical(chrom);
+  Metrics::Mark start = Metrics::mark(true),phase;
+
+  pool->lock();
+  TH1 *his    = getHistogram(getSignalName(name,bin_size,
+					   useATcorr,useGCcorr));
+  TH1 *rd_his = getHistogram(getDistrName(name,bin_size,
+					  useATcorr,useGCcorr));
+  if (!his || !rd_his) {
+    cerr<<"Can't find all histograms for '"<<chrom<<"'."<<endl;
+    delete his;
+    delete rd_his;
+    pool->unlock();
+    return;
+  }
     
-    cout<<"Partitioning RD signal for '"<<chrom
-	<<"' with bin size of "<<bin_size<<" ..."<<endl;
+  cout<<"Partitioning RD signal for '"<<chrom
+      <<"' with bin size of "<<bin_size<<" ..."<<endl;
 
-    double mean,sigma;
-    getMeanSigma(rd_his,mean,sigma);
-    cout<<"Average RD per bin is "<<mean<<" +- "<<sigma<<endl;
+  double mean,sigma;
+  getMeanSigma(rd_his,mean,sigma);
+  cout<<"Average RD per bin is "<<mean<<" +- "<<sigma<<endl;
     
-    int n_bins = his->GetNbinsX();
+  int n_bins = his->GetNbinsX();
     
-    TString hname = his->GetName();
-    TH1 *hl1 = (TH1*)his->Clone(hname + "_l1");
-    TH1 *hl2 = (TH1*)his->Clone(hname + "_l2");
-    TH1 *hl3 = (TH1*)his->Clone(hname + "_l3");
-    TH1 *partition =
-      (TH1*)his->Clone(getPartitionName(name,bin_size,useATcorr,useGCcorr));
-
-    double *rd = new double[n_bins],*level = new double[n_bins];
-    bool *mask = new bool[n_bins];
-    for (int b = 0;b < n_bins;b++) {
-      mask[b] = false;
-      rd[b]   = his->GetBinContent(b + 1);
-    }
+  TString hname = his->GetName();
+  TH1 *hl1 = (TH1*)his->Clone(hname + "_l1");
+  TH1 *hl2 = (TH1*)his->Clone(hname + "_l2");
+  TH1 *hl3 = (TH1*)his->Clone(hname + "_l3");
+  TH1 *partition =
+    (TH1*)his->Clone(getPartitionName(name,bin_size,useATcorr,useGCcorr));
+
+  double *rd = new double[n_bins],*level = new double[n_bins];
+  bool *mask = new bool[n_bins];
+  for (int b = 0;b < n_bins;b++) {
+    mask[b] = false;
+    rd[b]   = his->GetBinContent(b + 1);
+  }
+  delete his;
+  delete rd_his;
+  pool->unlock();
+  SegmentStats rd_stats(rd,n_bins);
     
-    for (int bin_band = 2;bin_band <= range;bin_band++) {
+  // Levels of unmasked bins depend only on mask and bin band, so bands in
+  // between matter only by changing mask. In adaptive mode, while mask
+  // stays the same (up to mask_tol_ of bins changing), steps of bin band
+  // are doubled. Last band is always done. This is a heuristic: a skipped
+  // band could have changed the mask, so partition isn't bound to the one
+  // made with all bands, even for mask_tol_ of 0.
+  int last_band = 0;
+  for (int bin_band = 2;bin_band <= jobs->range;bin_band++) {
+    last_band = bin_band;
+    bin_band  = nextBinBand(bin_band);
+  }
+  bool *prev_mask  = adaptive_bands_ ? new bool[n_bins]   : NULL;
+  double *prev_lev = adaptive_bands_ ? new double[n_bins] : NULL;
+  int n_stable = -1; // Number of bands in a row with the same mask
+  int n_bands = 0;
+  double levels_wall = 0,levels_cpu = 0,mask_wall = 0,mask_cpu = 0;
+
+  for (int bin_band = 2;bin_band <= jobs->range;bin_band++) {
       
-      cout<<"Bin band is "<<bin_band<<endl;
+    // Messages from several chromosomes would be mixed up
+    if (pool->numThreads() == 1) cout<<"Bin band is "<<bin_band<<endl;
       
-      for (int b = 0;b < n_bins;b++) 
-	if (!mask[b]) level[b] = rd[b];
+    for (int b = 0;b < n_bins;b++) 
+      if (!mask[b]) level[b] = rd[b];
 
-      calcLevels(level,mask,n_bins,bin_band,mean,sigma,skipMasked);
-      for (int b = 0;b < n_bins;b++) hl1->SetBinContent(b + 1,level[b]);
-      
-      calcLevels(level,mask,n_bins,bin_band,mean,sigma,skipMasked);
-      for (int b = 0;b < n_bins;b++) hl2->SetBinContent(b + 1,level[b]);
+    phase = Metrics::mark(true);
+    calcLevels(level,mask,n_bins,bin_band,mean,sigma,skipMasked,
+	       jobs->level_threads);
+    for (int b = 0;b < n_bins;b++) hl1->SetBinContent(b + 1,level[b]);
       
-      calcLevels(level,mask,n_bins,bin_band,mean,sigma,skipMasked);
-      for (int b = 0;b < n_bins;b++) hl3->SetBinContent(b + 1,level[b]);
+    calcLevels(level,mask,n_bins,bin_band,mean,sigma,skipMasked,
+	       jobs->level_threads);
+    for (int b = 0;b < n_bins;b++) hl2->SetBinContent(b + 1,level[b]);
       
-      if (skipMasked) {
-	updateMask_skip(rd,level,mask,n_bins,mean,sigma);
-      } else {
-	updateMask(rd,level,mask,n_bins,mean,sigma);
-      }
+    calcLevels(level,mask,n_bins,bin_band,mean,sigma,skipMasked,
+	       jobs->level_threads);
+    for (int b = 0;b < n_bins;b++) hl3->SetBinContent(b + 1,level[b]);
+    Metrics::Mark now = Metrics::mark(true);
+    levels_wall += now.wall - phase.wall;
+    levels_cpu  += now.cpu  - phase.cpu;
       
-      if (bin_band >=   8) bin_band +=  1;
-      if (bin_band >=  16) bin_band +=  2;
-      if (bin_band >=  32) bin_band +=  4;
-      if (bin_band >=  64) bin_band +=  8;
-      if (bin_band >= 128) bin_band += 16;
-      if (bin_band >= 256) bin_band += 32;
-      if (bin_band >= 512) bin_band += 64;
+    phase = now;
+    if (skipMasked) {
+      updateMask_skip(rd_stats,level,mask,n_bins,mean,sigma);
+    } else {
+      updateMask(rd_stats,level,mask,n_bins,mean,sigma);
     }
-    
-    for (int b = 0;b < n_bins;b++) partition->SetBinContent(b + 1,level[b]);
-    double prev = level[0],prev_delta = 0;
-    int count = 1;
-    for (int b = 1;b < n_bins;b++) {
-      if (TMath::Abs(level[b] - prev) < PRECISION) { count++; }
-      else {
-	rd_level->Fill(prev);
-	frag_len->Fill(count);
-	double delta = prev - level[b];
-	dl->Fill(TMath::Abs(delta));
-	dl2->Fill(prev_delta,delta);
-	prev = level[b];
-	prev_delta = delta;
-	count = 1;
+    now = Metrics::mark(true);
+    mask_wall += now.wall - phase.wall;
+    mask_cpu  += now.cpu  - phase.cpu;
+    n_bands++;
+
+    int next_band = nextBinBand(bin_band);
+    if (adaptive_bands_) {
+      int n_changed = 0;
+      for (int b = 0;n_stable >= 0 && b < n_bins;b++)
+	if (mask[b] != prev_mask[b] ||
+	    (mask[b] && !sameLevel(level[b],prev_lev[b]))) n_changed++;
+      if (n_stable >= 0 && n_changed <= mask_tol_*n_bins) n_stable++;
+      else                                                n_stable = 0;
+      for (int b = 0;b < n_bins;b++) {
+	prev_mask[b] = mask[b];
+	prev_lev[b]  = level[b];
+      }
+      if (n_stable > 0 && n_stable < 30) {
+	int step = next_band - bin_band + 1;
+	next_band += step*((1<<n_stable) - 1);
       }
+      if (bin_band < last_band && next_band >= last_band)
+	next_band = last_band - 1;
     }
+    bin_band = next_band;
+  }
+  delete[] prev_mask;
+  delete[] prev_lev;
+  if (metrics_) {
+    metrics_->record("partition","levels",chrom,levels_wall,levels_cpu,
+		     (long)n_bands*n_bins);
+    metrics_->record("partition","mask",chrom,mask_wall,mask_cpu,
+		     (long)n_bands*n_bins);
+  }
     
-    delete[] rd;
-    delete[] level;
-    delete[] mask;
-
-    // Chromosome specific
-    writeHistogramsToBinDir(partition,hl1,hl2,hl3);
-    delete hl1;
-    delete hl2;
-    delete hl3;
-    delete partition;
-
-    // General statistics
-    // If many chromosomes are analyzed then sum of all will be written last
-    writeHistogramsToBinDir(rd_level,frag_len,dl,dl2);
+  for (int b = 0;b < n_bins;b++) partition->SetBinContent(b + 1,level[b]);
+  Segments segments;
+  segments.build(level,n_bins,PRECISION);
+  double prev_delta = 0;
+  for (int i = 0;i + 1 < segments.size();i++) {
+    double delta = segments[i].level - segments[i + 1].level;
+    jobs->rd_level[thread]->Fill(segments[i].level);
+    jobs->frag_len[thread]->Fill(segments[i].n);
+    jobs->dl[thread]->Fill(TMath::Abs(delta));
+    jobs->dl2[thread]->Fill(prev_delta,delta);
+    prev_delta = delta;
   }
+    
+  delete[] rd;
+  delete[] level;
+  delete[] mask;
+
+  // Chromosome specific
+  pool->lock();
+  TH1 *his_segments =
+    segments.makeHistogram(getSegmentsName(name,bin_size,useATcorr,useGCcorr));
+  writeHistogramsToBinDir(partition,hl1,hl2,hl3,his_segments);
+  delete hl1;
+  delete hl2;
+  delete hl3;
+  delete partition;
+  delete his_segments;
+  pool->unlock();
+  jobs->items[job] = n_bins;
+  if (metrics_) metrics_->record("partition","chromosome",chrom,start,n_bins);
 }
-
-bool HisMaker::correctGC(TH1 *his,TH1 *his_gc,TH2* his_rd_gc,TH1 *his_mean)
+bool HisMaker::correctGC(TH1 *his,TH1 *his_gc,GCProfile &profile,
+			 const double *gc_corr)
 {
-  // Calculating array with average RD for GC
-  int N = his_rd_gc->GetNbinsX();
-  double width = 100./(N - 1),inv_width = 1./width;
-  double *gc_corr = new double[N];
-  calcGCcorrection(his_rd_gc,his_mean,gc_corr,N);
-
   int n_bins = his->GetNbinsX();
   for (int b = 1;b <= n_bins;b++) {
     double val = his->GetBinContent(b);
-    double gc  = his_gc->GetBinContent(b);
-    if (gc < 0) continue;
-    int ind = (int)(gc*inv_width + .5);
+    int ind = profile.index(his_gc->GetBinContent(b));
+    if (ind < 0) continue;
     if (gc_corr[ind] == -1) {
       cerr<<"Zero value of GC average."<<endl;
       cerr<<"Bin "<<b<<" with center "<<his->GetBinCenter(b)
@@ -1254,32 +1616,11 @@ bool HisMaker::correctGC(TH1 *his,TH1 *his_gc,TH2* his_rd_gc,TH1 *his_mean)
     } else his->SetBinContent(b,val*gc_corr[ind]);
   }
 
-  delete[] gc_corr;
   return true;
 }
 
-void HisMaker::calcGCcorrection(TH2* his_rd_gc,TH1 *his_mean,
-				double *corr,int n)
-{
-  for (int ind = 0;ind < n;ind++) {
-    int bin = ind + 1;
-    if (his_rd_gc->GetXaxis()->GetBinCenter(bin) > 89.99) {
-      TH1 *tmp = his_rd_gc->ProjectionY("tmp",bin,n);
-      while (ind < n) corr[ind++] = tmp->GetMean();
-    } else {
-      TH1 *tmp = his_rd_gc->ProjectionY("tmp",bin,bin);
-      corr[ind] = tmp->GetMean();
-    }
-  }
-
-  double global_average = getMean(his_mean);
-  for (int i = 0;i < n;i++)
-    if (corr[i] == 0) corr[i] = -1;
-    else corr[i] = global_average/corr[i];
-}
-
 bool HisMaker::correctGCbyFragment(TH1 *his,TH1 *his_gc,
-				   TH2* his_rd_gc,TH1 *his_mean)
+				   GCProfile &profile,TH1 *his_mean)
 {
   double global_average = getMean(his_mean);
   if (global_average <= 0) {
@@ -1313,19 +1654,8 @@ bool HisMaker::correctGCbyFragment(TH1 *his,TH1 *his_gc,
   }
 
   // Calculating array with average RD for GC
-  int N = his_rd_gc->GetNbinsX();
-  double width = 100./(N - 1),inv_width = 1./width;
-  double *gc_average = new double[N];
-  for (int ind = 0;ind < N;ind++) {
-    int bin = ind + 1;
-    if (his_rd_gc->GetXaxis()->GetBinCenter(bin) > 89.99) {
-      TH1 *tmp = his_rd_gc->ProjectionY("tmp",bin,N);
-      while (ind < N) gc_average[ind++] = tmp->GetMean();
-    } else {
-      TH1 *tmp = his_rd_gc->ProjectionY("tmp",bin,bin);
-      gc_average[ind] = tmp->GetMean();
-    }
-  }
+  double *gc_average = new double[profile.numBins()];
+  profile.averages(gc_average);
 
   nbins = his->GetNbinsX();
   for (int b = 1;b <= nbins;b++) {
@@ -1334,9 +1664,8 @@ bool HisMaker::correctGCbyFragment(TH1 *his,TH1 *his_gc,
     for (int i = 0;i <= N_precalc;i++) {
       int b1 = b - i,b2 = b + i;
       if (b1 >= 1) {
-	double gc  = his_gc->GetBinContent(b1);
-	if (gc < 0) continue;
-	int ind = (int)(gc*inv_width + .5);
+	int ind = profile.index(his_gc->GetBinContent(b1));
+	if (ind < 0) continue;
 	if (gc_average[ind] == 0) continue;
 	double tmp = gc_average[ind]/global_average;
 	if (min1 < 0 || tmp < min1) min1 = tmp;
@@ -1346,9 +1675,8 @@ bool HisMaker::correctGCbyFragment(TH1 *his,TH1 *his_gc,
 	nb++;
       }
       if (b2 <= nbins) {
-	double gc  = his_gc->GetBinContent(b2);
-	if (gc < 0) continue;
-	int ind = (int)(gc*inv_width + .5);
+	int ind = profile.index(his_gc->GetBinContent(b2));
+	if (ind < 0) continue;
 	double tmp = gc_average[ind]/global_average;
 	if (min2 < 0 || tmp < min2) min2 = tmp;
 	if (min2 < 0) continue;
@@ -1366,18 +1694,22 @@ bool HisMaker::correctGCbyFragment(TH1 *his,TH1 *his_gc,
   return true;
 }
 
-void HisMaker::updateMask(double *rd,double *level,bool *mask,int n_bins,
-			  double mean,double sigma)
+void HisMaker::updateMask(SegmentStats &rd,double *level,bool *mask,
+			  int n_bins,double mean,double sigma)
 {
   for (int b = 0;b < n_bins;b++) mask[b] = false;
 
+  Segments segments;
+  segments.build(level,n_bins,PRECISION);
+  int n_segs = segments.size();
+
   int ln = 0,n = 0,rn = 0;
   double average  = 0, variance  = 0;
   double laverage = 0, lvariance = 0;
   double raverage = 0, rvariance = 0;
   double inv_mean = 1/mean, inv_sigma = 1/sigma;
-  int start = 0, stop = -1;
-  while (getRegionRight(level,n_bins,stop + 1,start,stop)) {
+  for (int i = 0;i < n_segs;i++) {
+    int start = segments[i].start,stop = segments[i].stop;
 
     ln         = n;
     laverage   = average;
@@ -1387,16 +1719,16 @@ void HisMaker::updateMask(double *rd,double *level,bool *mask,int n_bins,
     average  = raverage;
     variance = rvariance;
 
-    int rstart,rstop;
-    if (!getRegionRight(level,n_bins,stop + 1,rstart,rstop)) break;
+    if (i + 1 >= n_segs) break;
+    int rstart = segments[i + 1].start,rstop = segments[i + 1].stop;
     getAverageVariance(rd,rstart,rstop,raverage,rvariance,rn);
 
-    int lstart,lstop;
-    if (!getRegionLeft(level,n_bins,start - 1,lstart,lstop)) {
+    if (i == 0) {
       // Have no left region -- need to calculate variances
       getAverageVariance(rd,start,stop,average,variance,n);
       continue;
     }
+    int lstop = start - 1;
 
     if (n <= 1) continue;
 
@@ -1425,24 +1757,30 @@ void HisMaker::updateMask(double *rd,double *level,bool *mask,int n_bins,
   }
 }
 
-void HisMaker::updateMask_skip(double *rd,double *level,bool *mask,int n_bins,
-			       double mean,double sigma)
+void HisMaker::updateMask_skip(SegmentStats &rd,double *level,bool *mask,
+			       int n_bins,double mean,double sigma)
 {
   for (int b = 0;b < n_bins;b++) mask[b] = false;
 
+  Segments segments;
+  segments.build(level,n_bins,PRECISION);
+  int n_segs = segments.size();
+
   double inv_mean = 1/mean, inv_sigma = 1/sigma;
-  int start = 0, stop = -1;
-  while (getRegionRight(level,n_bins,stop + 1,start,stop)) {
+  for (int i = 0;i < n_segs;i++) {
+    int start = segments[i].start,stop = segments[i].stop;
 
     double average  = 0, variance  = 0;
     int n = 0;
     getAverageVariance(rd,start,stop,average,variance,n);
     if (n == 1) continue;
 
+    // Left region is found walking back from its last bin, as it was
     int ln = 0, rn = 0;
-    int rstart,rstop,lstart,lstop;
-    if (!getRegionRight(level,n_bins,stop + 1,rstart,rstop)) continue;
-    rn = rstop - rstart + 1;
+    int rstart,lstart,lstop;
+    if (i + 1 >= n_segs) continue;
+    rstart = segments[i + 1].start;
+    rn     = segments[i + 1].n;
     if (!getRegionLeft(level,n_bins,start - 1,lstart,lstop)) continue;
     ln = lstop - lstart + 1;
 
@@ -1472,35 +1810,11 @@ void HisMaker::updateMask_skip(double *rd,double *level,bool *mask,int n_bins,
 }
 
 void HisMaker::calcLevels(double *level,bool *mask,int n_bins,int bin_band,
-			  double mean,double sigma,bool skipMasked)
+			  double mean,double sigma,bool skipMasked,
+			  int n_threads)
 {
   double *grad_b = new double[n_bins];
-  for (int b = 0;b < n_bins;b++) grad_b[b] = 0;
-
-  double inv2_bin_band = 1./(bin_band*bin_band);
-  double mean_4 = mean/4, sigma_2 = 4/(sigma*sigma),ms2 = mean/(sigma*sigma);
-  int    win = 3*bin_band;
-  double *exps = new double[win + 1];
-  for (int i = 0;i <= win;i++)
-    exps[i] = i*TMath::Exp(-0.5*i*i*inv2_bin_band);
-  for (int b = 0;b < n_bins;b++) {
-    if (mask[b]) continue;
-    double inv_b = 0; int d = 0;
-    if (level[b] < mean_4) inv_b = sigma_2;
-    else                   inv_b = ms2/level[b];
-    for (int i = b + 1;i < n_bins;i++) {
-      if (mask[i]) continue;
-      d++;
-      double inv_i = 0;
-      if (level[i] < mean_4) inv_i = sigma_2;
-      else                   inv_i = ms2/level[i];
-      double r = level[i] - level[b];
-      double val = -0.5*r*r;
-      grad_b[b] += exps[d]*TMath::Exp(val*inv_b);
-      grad_b[i] -= exps[d]*TMath::Exp(val*inv_i);
-      if (d == win) break;
-    }
-  }
+  levelGradient(level,mask,n_bins,bin_band,mean,sigma,grad_b,n_threads);
 
   // Calculating levels
   for (int b = 0;b < n_bins;b++) {
@@ -1539,47 +1853,196 @@ void HisMaker::calcLevels(double *level,bool *mask,int n_bins,int bin_band,
       if (!mask[i]) level[i] = nl;
   }
 
-  delete[] exps;
   delete[] grad_b;
 }
 
-bool HisMaker::mergeLevels(double *level,int n_bins,double delta)
+// Bin band before increment of partitioning loop: steps grow with band
+int HisMaker::nextBinBand(int bin_band)
 {
+  if (bin_band >=   8) bin_band +=  1;
+  if (bin_band >=  16) bin_band +=  2;
+  if (bin_band >=  32) bin_band +=  4;
+  if (bin_band >=  64) bin_band +=  8;
+  if (bin_band >= 128) bin_band += 16;
+  if (bin_band >= 256) bin_band += 32;
+  if (bin_band >= 512) bin_band += 64;
+  return bin_band;
+}
+
+// Segments of levels in mergeLevels(), linked in order and indexed by their
+// first bin. Levels of merged segments are kept in val[] and written into
+// bins at the end, or once segment is joined with its neighbours.
+struct LevelSegments
+{
+  double *level,*val;
+  int    *len,*prev,*next;
+  bool   *flat;           // Bins are not written yet, all are at val[]
+  bool   *changed;        // Merged in current pass
+  vector<int> starts,old; // Used by rescanLevels()
+
+  double first(int s) { return flat[s] ? val[s] : level[s]; }
+  double last(int s)  { return flat[s] ? val[s] : level[s + len[s] - 1]; }
+  void   write(int s)
+  {
+    if (!flat[s]) return;
+    for (int i = s;i < s + len[s];i++) level[i] = val[s];
+    flat[s] = false;
+  }
+};
+
+// Finds segments anew, as scanning at start of pass does, from the one
+// before changed segment s up to first unchanged segment past it. New
+// segments and their neighbours are added to visits. Returns first bin
+// after the scan.
+static int rescanLevels(LevelSegments &seg,int s,vector<int> &visits)
+{
+  int x = (seg.prev[s] >= 0) ? seg.prev[s] : s;
+  int before = seg.prev[x];
+  seg.starts.clear();
+  seg.old.clear();
+  int o = x,b = x;
+  while (true) {
+    int start = b,n_pieces = 0;
+    double f = seg.flat[o] ? seg.val[o] : seg.level[b];
+    while (o >= 0) {
+      int o_end = o + seg.len[o],from = b;
+      if (!seg.flat[o])
+	while (b < o_end && TMath::Abs(seg.level[b] - f) < PRECISION) b++;
+      else if (TMath::Abs(seg.val[o] - f) < PRECISION) b = o_end;
+      if (b == from) break;
+      if (++n_pieces == 2) seg.write(start);
+      if (n_pieces >= 2)   seg.write(o);
+      if (b < o_end) break;
+      seg.old.push_back(o);
+      o = seg.next[o];
+    }
+    seg.starts.push_back(start);
+    if (o < 0 || (b == o && b > s && !seg.changed[o])) break;
+  }
+
+  for (unsigned int i = 0;i < seg.old.size();i++) {
+    seg.len[seg.old[i]]     = 0;
+    seg.changed[seg.old[i]] = false;
+  }
+  int n = seg.starts.size();
+  for (int i = 0;i < n;i++) {
+    int ns = seg.starts[i];
+    seg.len[ns]  = ((i + 1 < n) ? seg.starts[i + 1] : b) - ns;
+    seg.prev[ns] = (i > 0) ? seg.starts[i - 1] : before;
+    seg.next[ns] = (i + 1 < n) ? seg.starts[i + 1] : o;
+    visits.push_back(ns);
+  }
+  if (o >= 0) {
+    seg.prev[o] = seg.starts[n - 1];
+    visits.push_back(o);
+  }
+  if (before >= 0) {
+    seg.next[before] = seg.starts[0];
+    visits.push_back(before);
+    if (seg.prev[before] >= 0) visits.push_back(seg.prev[before]);
+  }
+  return b;
+}
+
+// Merges neighbouring segments of levels that differ by less than delta and
+// by less than each of them differs from its other neighbour. Merging is
+// done in passes over segments from left to right, each pass finding
+// segments anew, until nothing is merged. Segments are linked, and a pass
+// visits only segments next to ones merged before (in this pass or the
+// previous one), which are the only ones that can merge; so the result is
+// that of full passes, at a cost set by number of merges, not of passes
+// times bins. Starts from given segments (found from levels if there are
+// none) and leaves merged ones in them.
+bool HisMaker::mergeLevels(double *level,int n_bins,double delta,
+			   Segments &segments)
+{
+  if (n_bins <= 0) return false;
+
+  LevelSegments seg;
+  seg.level   = level;
+  seg.val     = new double[n_bins];
+  seg.len     = new int[n_bins];
+  seg.prev    = new int[n_bins];
+  seg.next    = new int[n_bins];
+  seg.flat    = new bool[n_bins];
+  seg.changed = new bool[n_bins];
+  vector<int> visits,later,changed;
+  if (segments.size() == 0) segments.build(level,n_bins,PRECISION);
+  for (int b = 0;b < n_bins;b++) seg.len[b] = 0;
+  for (int i = 0;i < segments.size();i++) {
+    int s = segments[i].start;
+    seg.len[s]  = segments[i].n;
+    seg.prev[s] = visits.empty() ? -1 : visits.back();
+    seg.next[s] = (i + 1 < segments.size()) ? segments[i + 1].start : -1;
+    visits.push_back(s);
+  }
+  for (int b = 0;b < n_bins;b++) seg.flat[b] = seg.changed[b] = false;
+
+  // Pass visits segments in order; merged segment is visited again until it
+  // can't merge, then its right neighbour. Segments left of merged one are
+  // visited in next pass.
   bool ret = false;
+  while (!visits.empty()) {
+    unsigned int i = 0;
+    int right = -1;
+    while (right >= 0 || i < visits.size()) {
+      int s1 = right;
+      if (s1 < 0) s1 = visits[i++];
+      right = -1;
+      if (seg.len[s1] == 0) continue;
+      while (seg.next[s1] >= 0) {
+	int s2 = seg.next[s1],p = seg.prev[s1],nn = seg.next[s2];
+	double v1 = TMath::Abs(seg.first(s1) - seg.first(s2));
+	if (v1 >= delta) break;
+	double v2 = v1 + 1, v3 = v1 + 1;
+	if (p  >= 0) v2 = TMath::Abs(seg.first(s1) - seg.last(p));
+	if (nn >= 0) v3 = TMath::Abs(seg.last(s2)  - seg.first(nn));
+	if (v1 >= v2 || v1 >= v3) break;
 
-  int start1 = 0, end1 = 0, start2, end2;
-  while (end1 < n_bins &&
-	 TMath::Abs(level[end1] - level[start1]) < PRECISION) end1++;
-  end1--; start2 = end2 = end1 + 1;
-  while (end2 < n_bins &&
-	 TMath::Abs(level[end2] - level[start2]) < PRECISION) end2++;
-  end2--;
-
-  while (start2 < n_bins) {
-    double v1 = TMath::Abs(level[start1] - level[start2]);
-    if (v1 < delta) {
-      double v2 = v1 + 1, v3 = v1 + 1;
-      if (start1 - 1 >= 0)
-	v2 = TMath::Abs(level[start1] - level[start1 - 1]);
-      if (end2 + 1 < n_bins)
-	v3 = TMath::Abs(level[end2]   - level[end2 + 1]);
-      if (v1 < v2 && v1 < v3) {
 	ret = true;
-	double nl = (end1 - start1 + 1)*level[start1];
-	nl       += (end2 - start2 + 1)*level[start2];
-	nl       *= getInverse(end2 - start1 + 1);
-	for (int i = start1;i <= end2;i++) level[i] = nl;
-	start2 = start1;
+	double nl = seg.len[s1]*seg.first(s1) + seg.len[s2]*seg.first(s2);
+	seg.len[s1] += seg.len[s2];
+	seg.val[s1]  = nl*getInverse(seg.len[s1]);
+	seg.flat[s1] = true;
+	seg.len[s2]  = 0;
+	seg.flat[s2] = false;
+	seg.next[s1] = nn;
+	if (nn >= 0) seg.prev[nn] = s1;
+	if (!seg.changed[s1]) {
+	  seg.changed[s1] = true;
+	  changed.push_back(s1);
+	}
+	right = nn;
+	if (p >= 0) {
+	  if (seg.prev[p] >= 0) later.push_back(seg.prev[p]);
+	  later.push_back(p);
+	}
       }
+      while (i < visits.size() && visits[i] <= right) i++;
     }
-    start1 = start2;
-    end1   = end2;
-    start2 = end2 = end1 + 1;
-    while (end2 < n_bins &&
-	   TMath::Abs(level[end2] - level[start2]) < PRECISION) end2++;
-    end2--;
+    // Finding segments for next pass around merged ones
+    int scanned = 0;
+    for (unsigned int c = 0;c < changed.size();c++)
+      if (changed[c] >= scanned && seg.changed[changed[c]])
+	scanned = rescanLevels(seg,changed[c],later);
+    changed.clear();
+    sort(later.begin(),later.end());
+    later.erase(unique(later.begin(),later.end()),later.end());
+    visits.swap(later);
+    later.clear();
   }
 
+  segments.clear();
+  for (int s = 0;s >= 0;s = seg.next[s]) {
+    seg.write(s);
+    segments.add(s,s + seg.len[s] - 1,level[s]);
+  }
+  delete[] seg.val;
+  delete[] seg.len;
+  delete[] seg.prev;
+  delete[] seg.next;
+  delete[] seg.flat;
+  delete[] seg.changed;
   return ret;
 }
 
@@ -1736,6 +2199,7 @@ TTree *HisMaker::fitValley2ATbias(TH1 *his_read,TH1 *his_frg)
 //     if (input == "exit") return NULL;
   }
 
+  cache_.closeFile(root_file_name);
   TFile file(root_file_name.Data(),"Update");
   if (file.IsZombie()) {
     cerr<<"Can't open/write to file '"<<root_file_name<<"'."<<endl;
@@ -1787,6 +2251,7 @@ void HisMaker::stat(string *user_chroms,int n_chroms,bool useATcorr)
     user_chroms = chr_names;
   }
 
+  Metrics::Mark start = Metrics::mark(),phase;
   if (useATcorr) {
     TH2* his_read_frg = (TH2*)getHistogram("read_frg_len",root_file_name,"");
     TH1 *his_read = NULL,*his_frg = NULL;
@@ -1840,90 +2305,39 @@ void HisMaker::stat(string *user_chroms,int n_chroms,bool useATcorr)
     }
     
     if (his_read_frg && his_read && his_frg && RANGE > 0) {
-      double RANGE_over = 1./RANGE;
-      for (int c = 0;c < n_chroms;c++) { // Correcting for AT run bias
-	string chrom   = user_chroms[c];
-	string name    = Genome::makeCanonical(chrom);
-	string name_at = name; name_at += "_at";
-	cout<<"Correcting AT run bias for "<<chrom<<" ..."<<endl;
-	TH1 *his_p = getHistogram(getSignalName(name,bin_size,false,false));
-	if (!his_p) {
-	  cerr<<"Can't find RD histogram for '"<<chrom<<"'."<<endl;
-	  continue;
-	}
-	TFile file(root_file_name,"Read");
-	if (file.IsZombie()) { 
-	  cerr<<"Can't open file '"<<root_file_name<<"'."<<endl;
-	  return;
-	}
-	TTree *tree = (TTree*)file.Get(name_at.c_str());
-	if (!tree) {
-	  cerr<<"Can't find AT run tree for '"<<chrom<<"'."<<endl;
-	  continue;
-	}
-	int start,end;
-	tree->SetBranchAddress("start",&start);
-	tree->SetBranchAddress("end",  &end);
-	int n_ent = tree->GetEntries(),atn = 2*n_ent,ati = 0;
-	int *at_run = new int[atn];
-	for (int i = 0;i < n_ent;i++) {
-	  tree->GetEntry(i);
-	  at_run[ati++] = start;
-	  at_run[ati++] = end;
-	}
-	int nbins = his_p->GetNbinsX();
-
-	ati = 0;
-	for (int b = 1;b <= nbins;b++) {
-	  double val = 0,np = 0,add = 0;
-	  start = int(his_p->GetBinLowEdge(b) + 0.5);
-	  end   = int(his_p->GetBinLowEdge(b) + his_p->GetBinWidth(b) + 0.5);
-	  for (int p = start;p <= end;p++) {
-	    double p5 = 1,p3 = 1,add5 = 0,add3 = 0;
-	    while (p > at_run[ati + 1] + RANGE && ati < atn) ati += 2;
-	    for (int j = ati;j < atn;j += 2) {
-	      if (p < at_run[j] - RANGE) break;
-	      bool is5 = at_run[j + 1] < p,is3 = at_run[j] > p;
-	      int offset = 0;
-	      if      (is5) offset = p - at_run[j + 1];
-	      else if (is3) offset = at_run[j] - p;
-	      int len     = at_run[j + 1] - at_run[j] + 1;
-	      //double lost = len*0.039 - 0.59; if (lost < 0) lost = 0;
-	      double lost = len*P1 + P0; if (lost < 0) lost = 0;
-	      double p = (1 - lost) + lost*RANGE_over*offset;
-	      if (p < 0) p = 0;
-	      
-	      int bin = his_read->GetBin(offset);
-	      double tmp = 0;
-	      if (bin >= 1 && bin <= his_read->GetNbinsX())
-		tmp += NORM_READ*lost/len*his_read->GetBinContent(bin);
-	      offset = int(offset - SHIFT + 0.5);
-	      bin = his_frg->GetBin(offset);
-	      if (bin >= 1 && bin <= his_frg->GetNbinsX())
-		tmp += NORM_FRG*lost/len*his_frg->GetBinContent(offset);
-	      
-	      if      (is5) add5  = (add5 + tmp)*p;
-	      else if (is3) add3 += tmp*p3;
-	      if      (is5) p5 *= p;
-	      else if (is3) p3 *= p;
-	    }
-	    
-	    val += 0.5*p5 + 0.5*p3;
-	    add += add3 + add5;
-	    np++;
-	  }
-	  val += 0.5*add;
-	  val /= np;
-	  if (val > 0)
-	    his_p->SetBinContent(b,his_p->GetBinContent(b)/val);
-	}
-	his_p->SetName(getSignalName(name,bin_size,true,false));
-	writeHistogramsToBinDir(his_p);
-	delete[] at_run;
-      }
+      // Correcting for AT run bias
+      ThreadPool pool(n_threads_);
+      ChromosomeJobs jobs = ChromosomeJobs();
+      jobs.maker     = this;
+      jobs.pool      = &pool;
+      jobs.chroms    = user_chroms;
+      jobs.his_read  = his_read;
+      jobs.his_frg   = his_frg;
+      jobs.range_at  = RANGE;
+      jobs.norm_frg  = NORM_FRG;
+      jobs.norm_read = NORM_READ;
+      jobs.shift     = SHIFT;
+      jobs.p0        = P0;
+      jobs.p1        = P1;
+      jobs.items     = new long[n_chroms]();
+      phase = Metrics::mark();
+      beginOutput();
+      pool.run(correctATJob,&jobs,n_chroms);
+      endOutput();
+      if (metrics_)
+	metrics_->record("stat","at_correction","",phase,
+			 sumItems(jobs,n_chroms));
+      delete[] jobs.items;
     }
   }
 
+  // Signals are read once and kept in memory: first sweep makes statistics
+  // and averages per GC bin, second one corrects signals by GC-content and
+  // makes statistics of corrected signals
+  phase = Metrics::mark();
+  long n_items = 0;
+  beginOutput();
+
   // Statistics for uncorrected
   TH1* rd_p    = new TH1D(getDistrName(chrAll,bin_size,false,false),
 			  "RD all",   5001,-0.5,5000.5);
@@ -1931,6 +2345,8 @@ void HisMaker::stat(string *user_chroms,int n_chroms,bool useATcorr)
 			  "RD all XY",5001,-0.5,5000.5);
   TH1 *rd_u       = new TH1D(rd_u_name,   "RD unique",   5001,-0.5,5000.5);
   TH1 *rd_u_xy    = new TH1D(rd_u_xy_name,"RD unique XY",5001,-0.5,5000.5);
+  GCProfile profile(bin_size),profile_xy(bin_size);
+  vector<TH1*> signals(n_chroms,(TH1*)NULL),gcs(n_chroms,(TH1*)NULL);
   for (int c = 0;c < n_chroms;c++) {
     string chrom = user_chroms[c];
     string name  = Genome::makeCanonical(chrom);
@@ -1947,6 +2363,7 @@ void HisMaker::stat(string *user_chroms,int n_chroms,bool useATcorr)
 
     if (his_p) {
       int n = his_p->GetNbinsX();
+      n_items += n;
       int position = 1;
       for (int i = 1;i <= n;i++) { // All RD
 	double val = his_p->GetBinContent(i);
@@ -1958,13 +2375,15 @@ void HisMaker::stat(string *user_chroms,int n_chroms,bool useATcorr)
 
     if (his_gc && his_p) { // Correlation of RD and GC
       int n = his_gc->GetNbinsX();
-      if (name == chrX || name == chrY)
-	for (int i = 1;i <= n;i++) 
-	  rd_gc_xy->Fill(his_gc->GetBinContent(i),
-			 his_p->GetBinContent(i));
-      else for (int i = 1;i <= n;i++) 
-	     rd_gc->Fill(his_gc->GetBinContent(i),
-			 his_p->GetBinContent(i));
+      bool xy = (name == chrX || name == chrY);
+      GCProfile &prof = xy ? profile_xy : profile;
+      for (int i = 1;i <= n;i++)
+	prof.fill(his_gc->GetBinContent(i),his_p->GetBinContent(i));
+      if (gc_qc_) {
+	TH2 *his_rd_gc = xy ? rd_gc_xy : rd_gc;
+	for (int i = 1;i <= n;i++)
+	  his_rd_gc->Fill(his_gc->GetBinContent(i),his_p->GetBinContent(i));
+      }
     }
 
     if (his_u) { // Unique RD
@@ -1974,6 +2393,14 @@ void HisMaker::stat(string *user_chroms,int n_chroms,bool useATcorr)
       else
 	for (int i = 1;i <= n;i++) rd_u->Fill(his_u->GetBinContent(i));
     }
+
+    // Signal to be corrected, with its GC-content, for the second sweep
+    if (useATcorr) {
+      signals[c] = getHistogram(getSignalName(name,bin_size,true,false));
+      delete his_p;
+    } else signals[c] = his_p;
+    gcs[c] = his_gc;
+    delete his_u;
   }
 
   double mean,sigma;
@@ -1984,36 +2411,17 @@ void HisMaker::stat(string *user_chroms,int n_chroms,bool useATcorr)
   cout<<"Average RD per bin (X,Y)  is "<<mean<<" +- "<<sigma
       <<" (before GC correction)"<<endl;
 
-  writeHistogramsToBinDir(rd_u,rd_u_xy,rd_p,rd_p_xy,rd_gc,rd_gc_xy);
-
-  // Correcting by GC-content
-  for (int c = 0;c < n_chroms;c++) {
-    string chrom = user_chroms[c];
-    string name   = Genome::makeCanonical(chrom);
-    cout<<"Correcting counts by GC-content for '"<<chrom<<"' ..."<<endl;
-
-    TString new_his_name = getSignalName(name,bin_size,useATcorr,true);
-    TH1 *his_p  = getHistogram(getSignalName(name,bin_size,useATcorr,false));
-    TH1 *his_gc = getHistogram(getGCName(name,bin_size));
-    if (!his_p) continue;
-
-    TH1 *his_corrected = his_p;
-    if (!his_gc) {
-      cerr<<"No histogram with GC content for '"<<chrom<<"' found."<<endl;
-      cerr<<"No correction made."<<endl;
-    } else {
-      if (name == chrX || name == chrY)
-	//correctGCbyFragment(his_p,his_gc,rd_gc_xy,rd_p_xy);
-	correctGC(his_p,his_gc,rd_gc_xy,rd_p_xy);
-      else
-	//correctGCbyFragment(his_p,his_gc,rd_gc,rd_p);
-	correctGC(his_p,his_gc,rd_gc,rd_p);
-    }
-    his_corrected->SetName(new_his_name);
-    writeHistogramsToBinDir(his_corrected);
-  }
-
-  // Statistics for corrected counts
+  writeHistogramsToBinDir(rd_u,rd_u_xy,rd_p,rd_p_xy);
+  if (gc_qc_) writeHistogramsToBinDir(rd_gc,rd_gc_xy);
+  if (metrics_) metrics_->record("stat","distribution","",phase,n_items);
+
+  // Correcting by GC-content and statistics for corrected counts
+  phase = Metrics::mark();
+  n_items = 0;
+  double *gc_corr    = new double[profile.numBins()];
+  double *gc_corr_xy = new double[profile_xy.numBins()];
+  profile.correction(getMean(rd_p),gc_corr);
+  profile_xy.correction(getMean(rd_p_xy),gc_corr_xy);
   TH1* rd_p_GC    = new TH1D(getDistrName(chrAll,bin_size,useATcorr,true),
 			     "RD all (GC corrected)",   5001,-0.5,5000.5);
   TH1* rd_p_xy_GC = new TH1D(getDistrName("chrX",bin_size,useATcorr,true),
@@ -2021,33 +2429,41 @@ void HisMaker::stat(string *user_chroms,int n_chroms,bool useATcorr)
   for (int c = 0;c < n_chroms;c++) {
     string chrom = user_chroms[c];
     string name   = Genome::makeCanonical(chrom);
-    cout<<"Making statistics for "<<chrom<<" after GC correction ..."<<endl;
-    TH1 *his_p  = getHistogram(getSignalName(name,bin_size,useATcorr,true));
-    TH1 *his_gc = getHistogram(getGCName(name,bin_size));
-
+    TH1 *his_p = signals[c],*his_gc = gcs[c];
     if (!his_p) {
       cerr<<"Can't find histogram for '"<<chrom<<"'."<<endl;
+      delete his_gc;
       continue;
     }
+    cout<<"Correcting counts by GC-content for '"<<chrom<<"' ..."<<endl;
 
-    int n = his_p->GetNbinsX();
-    if (name == chrX || name == chrY)
-      for (int i = 1;i <= n;i++) rd_p_xy_GC->Fill(his_p->GetBinContent(i));
+    bool xy = (name == chrX || name == chrY);
+    if (!his_gc) {
+      cerr<<"No histogram with GC content for '"<<chrom<<"' found."<<endl;
+      cerr<<"No correction made."<<endl;
+    } else if (xy)
+      //correctGCbyFragment(his_p,his_gc,profile_xy,rd_p_xy);
+      correctGC(his_p,his_gc,profile_xy,gc_corr_xy);
     else
-      for (int i = 1;i <= n;i++) rd_p_GC->Fill(his_p->GetBinContent(i));
+      //correctGCbyFragment(his_p,his_gc,profile,rd_p);
+      correctGC(his_p,his_gc,profile,gc_corr);
+    his_p->SetName(getSignalName(name,bin_size,useATcorr,true));
+    writeHistogramsToBinDir(his_p);
 
-    if (!his_gc) {
-      cerr<<"Can't find GC-content histogram for '"<<chrom<<"'."<<endl;
-      continue;
+    int n = his_p->GetNbinsX();
+    n_items += n;
+    TH1 *his_rd = xy ? rd_p_xy_GC : rd_p_GC;
+    for (int i = 1;i <= n;i++) his_rd->Fill(his_p->GetBinContent(i));
+    if (gc_qc_ && his_gc) {
+      TH2 *his_rd_gc = xy ? rd_gc_xy_GC : rd_gc_GC;
+      for (int i = 1;i <= n;i++)
+	his_rd_gc->Fill(his_gc->GetBinContent(i),his_p->GetBinContent(i));
     }
-
-    if (name == chrX || name == chrY)
-      for (int i = 1;i <= n;i++)
-	rd_gc_xy_GC->Fill(his_gc->GetBinContent(i),his_p->GetBinContent(i));
-    else 
-      for (int i = 1;i <= n;i++)
-	rd_gc_GC->Fill(his_gc->GetBinContent(i),his_p->GetBinContent(i));
+    delete his_p;
+    delete his_gc;
   }
+  delete[] gc_corr;
+  delete[] gc_corr_xy;
 
   getMeanSigma(rd_p_GC,mean,sigma);
   cout<<"Average RD per bin (1-22) is "<<mean<<" +- "<<sigma
@@ -2057,7 +2473,123 @@ void HisMaker::stat(string *user_chroms,int n_chroms,bool useATcorr)
   cout<<"Average RD per bin (X,Y)  is "<<mean<<" +- "<<sigma
       <<" (after GC correction)"<<endl;
 
-  writeHistogramsToBinDir(rd_p_GC,rd_p_xy_GC,rd_gc_GC,rd_gc_xy_GC);
+  writeHistogramsToBinDir(rd_p_GC,rd_p_xy_GC);
+  if (gc_qc_) writeHistogramsToBinDir(rd_gc_GC,rd_gc_xy_GC);
+  endOutput();
+  if (metrics_) {
+    metrics_->record("stat","gc_correction","",phase,n_items);
+    metrics_->record("stat","total","",start,n_items);
+  }
+}
+
+void HisMaker::correctATJob(int job,int thread,void *arg)
+{
+  ChromosomeJobs *jobs = (ChromosomeJobs*)arg;
+  jobs->maker->correctATChromosome(jobs,job,thread);
+}
+
+void HisMaker::correctATChromosome(ChromosomeJobs *jobs,int job,int thread)
+{
+  ThreadPool *pool = jobs->pool;
+  TH1 *his_read = jobs->his_read,*his_frg = jobs->his_frg;
+  double RANGE = jobs->range_at,RANGE_over = 1./RANGE,SHIFT = jobs->shift;
+  double NORM_FRG = jobs->norm_frg,NORM_READ = jobs->norm_read;
+  double P0 = jobs->p0,P1 = jobs->p1;
+  string chrom   = jobs->chroms[job];
+  string name    = Genome::makeCanonical(chrom);
+  string name_at = name; name_at += "_at";
+  Metrics::Mark begin = Metrics::mark(true);
+
+  pool->lock();
+  cout<<"Correcting AT run bias for "<<chrom<<" ..."<<endl;
+  TH1 *his_p = getHistogram(getSignalName(name,bin_size,false,false));
+  if (!his_p) {
+    cerr<<"Can't find RD histogram for '"<<chrom<<"'."<<endl;
+    pool->unlock();
+    return;
+  }
+  TFile file(root_file_name,"Read");
+  if (file.IsZombie()) { 
+    cerr<<"Can't open file '"<<root_file_name<<"'."<<endl;
+    delete his_p;
+    pool->unlock();
+    return;
+  }
+  TTree *tree = (TTree*)file.Get(name_at.c_str());
+  if (!tree) {
+    cerr<<"Can't find AT run tree for '"<<chrom<<"'."<<endl;
+    delete his_p;
+    pool->unlock();
+    return;
+  }
+  int start,end;
+  tree->SetBranchAddress("start",&start);
+  tree->SetBranchAddress("end",  &end);
+  int n_ent = tree->GetEntries(),atn = 2*n_ent,ati = 0;
+  int *at_run = new int[atn];
+  for (int i = 0;i < n_ent;i++) {
+    tree->GetEntry(i);
+    at_run[ati++] = start;
+    at_run[ati++] = end;
+  }
+  delete tree;
+  file.Close();
+  pool->unlock();
+  int nbins = his_p->GetNbinsX();
+
+  ati = 0;
+  for (int b = 1;b <= nbins;b++) {
+    double val = 0,np = 0,add = 0;
+    start = int(his_p->GetBinLowEdge(b) + 0.5);
+    end   = int(his_p->GetBinLowEdge(b) + his_p->GetBinWidth(b) + 0.5);
+    for (int p = start;p <= end;p++) {
+      double p5 = 1,p3 = 1,add5 = 0,add3 = 0;
+      while (p > at_run[ati + 1] + RANGE && ati < atn) ati += 2;
+      for (int j = ati;j < atn;j += 2) {
+	if (p < at_run[j] - RANGE) break;
+	bool is5 = at_run[j + 1] < p,is3 = at_run[j] > p;
+	int offset = 0;
+	if      (is5) offset = p - at_run[j + 1];
+	else if (is3) offset = at_run[j] - p;
+	int len     = at_run[j + 1] - at_run[j] + 1;
+	//double lost = len*0.039 - 0.59; if (lost < 0) lost = 0;
+	double lost = len*P1 + P0; if (lost < 0) lost = 0;
+	double p = (1 - lost) + lost*RANGE_over*offset;
+	if (p < 0) p = 0;
+
+	int bin = his_read->GetBin(offset);
+	double tmp = 0;
+	if (bin >= 1 && bin <= his_read->GetNbinsX())
+	  tmp += NORM_READ*lost/len*his_read->GetBinContent(bin);
+	offset = int(offset - SHIFT + 0.5);
+	bin = his_frg->GetBin(offset);
+	if (bin >= 1 && bin <= his_frg->GetNbinsX())
+	  tmp += NORM_FRG*lost/len*his_frg->GetBinContent(offset);
+
+	if      (is5) add5  = (add5 + tmp)*p;
+	else if (is3) add3 += tmp*p3;
+	if      (is5) p5 *= p;
+	else if (is3) p3 *= p;
+      }
+
+      val += 0.5*p5 + 0.5*p3;
+      add += add3 + add5;
+      np++;
+    }
+    val += 0.5*add;
+    val /= np;
+    if (val > 0)
+      his_p->SetBinContent(b,his_p->GetBinContent(b)/val);
+  }
+  delete[] at_run;
+
+  pool->lock();
+  his_p->SetName(getSignalName(name,bin_size,true,false));
+  writeHistogramsToBinDir(his_p);
+  delete his_p;
+  pool->unlock();
+  jobs->items[job] = nbins;
+  if (metrics_) metrics_->record("stat","at_correction",chrom,begin,nbins);
 }
 
 void HisMaker::eval(string *files,int n_files,bool useATcorr,bool useGCcorr)
@@ -2087,17 +2619,11 @@ void HisMaker::eval(string *files,int n_files,bool useATcorr,bool useGCcorr)
 
 int HisMaker::countGCpercentage(char *seq,int low,int up)
 {
-  int n_a = 0, n_t = 0, n_g = 0, n_c = 0;
-  for (int p = low;p < up;p++) {
-    char c = seq[p];
-    if      (c == 'a' || c == 'A') n_a++;
-    else if (c == 't' || c == 'T') n_t++;
-    else if (c == 'g' || c == 'G') n_g++;
-    else if (c == 'c' || c == 'C') n_c++;
-  }
-  int n_total = n_a + n_t + n_c + n_g;
+  int n_gc,n_at;
+  GCIndex::count(seq + low,up - low,n_gc,n_at);
+  int n_total = n_gc + n_at;
   if (n_total == 0) return -100;
-  return int((n_c + n_g)*100./n_total + 0.5);
+  return int(n_gc*100./n_total + 0.5);
 }
 
 int parseChromosomeLength(TString description)
@@ -2109,6 +2635,73 @@ int parseChromosomeLength(TString description)
   return tmp.Atoi();
 }
 
+// Index of chromosome in read depth file, -1 if not there
+int findRDChromosome(RDFile &rdf,string chrom)
+{
+  int ret = rdf.chromIndex(chrom);
+  if (ret < 0) ret = rdf.chromIndex(Genome::makeCanonical(chrom));
+  return ret;
+}
+
+int greatestCommonDivisor(int a,int b)
+{
+  while (b > 0) {
+    int tmp = a%b;
+    a = b;
+    b = tmp;
+  }
+  return a;
+}
+
+// Prefix sums of GC and AT bases over chunks of step bases: gc_sum[j] and
+// at_sum[j] count bases in seq[0 .. j*step). Returns number of chunks.
+int sumGCandAT(char *seq,int len,int step,int *gc_sum,int *at_sum)
+{
+  int n = (len + step - 1)/step;
+  gc_sum[0] = at_sum[0] = 0;
+  for (int j = 0;j < n;j++) {
+    int n_gc,n_at,start = j*step,end = start + step;
+    if (end > len) end = len;
+    GCIndex::count(seq + start,end - start,n_gc,n_at);
+    gc_sum[j + 1] = gc_sum[j] + n_gc;
+    at_sum[j + 1] = at_sum[j] + n_at;
+  }
+  return n;
+}
+
+bool HisMaker::readGCandAT(string chrom,int len,int step,char *seq,
+			   int *gc_sum,int *at_sum)
+{
+  string chrom_file = sequenceFile(chrom);
+  GCIndex index;
+  if (step%GCIndex::CHUNK == 0 && index.load(chrom_file,chrom) &&
+      index.length() == len) {
+    index.sums(step,gc_sum,at_sum);
+    return true;
+  }
+  if (readChromosome(chrom,seq,len) != len) return false;
+  sumGCandAT(seq,len,step,gc_sum,at_sum);
+  index.build(seq,len);
+  index.save(chrom_file,chrom);
+  return true;
+}
+
+bool HisMaker::readGCAnnotation(GCAnnotation *annotation,string chrom,
+				int len,int *bins,int n_bins,
+				const signed char **gc)
+{
+  if (!annotation || !annotation->isOpen()) return false;
+  int ci = annotation->chromIndex(chrom);
+  if (ci < 0 || annotation->chromLen(ci) != len) return false;
+  if (!annotation->isCurrent(ci,sequenceFile(chrom))) {
+    cerr<<"Sequence of '"<<chrom<<"' has changed since annotation."<<endl;
+    return false;
+  }
+  for (int b = 0;b < n_bins;b++)
+    if (!(gc[b] = annotation->gcPercent(ci,bins[b]))) return false;
+  return true;
+}
+
 int getIndexForName(string name,string *arr,int n)
 {
   for (int i = 0;i < n;i++)
@@ -2322,7 +2915,7 @@ void HisMaker::produceHistogramsNew(string *user_chroms,int user_n_chroms)
 
 void HisMaker::produceHistograms(string *user_chroms,int n_chroms,
 				 string *root_files,int n_root_files,
-				 bool useGCcorr)
+				 bool useGCcorr,int *bins,int n_bins)
 {
   if (user_chroms == NULL && n_chroms != 0) {
     cerr<<"No chromosome names given."<<endl
@@ -2332,6 +2925,22 @@ void HisMaker::produceHistograms(string *user_chroms,int n_chroms,
 
   if (n_root_files < 1) return;
 
+  if (bins == NULL || n_bins <= 0) {
+    bins   = &bin_size;
+    n_bins = 1;
+  }
+  for (int b = 0;b < n_bins;b++)
+    if (bins[b] <= 0) {
+      cerr<<"Bin size must be positive."<<endl
+	  <<"Aborting making histogram."<<endl;
+      return;
+    }
+  // Reads are counted in bins of greatest common divisor of bin sizes,
+  // which are then summed up for each bin size
+  int step = bins[0];
+  for (int b = 1;b < n_bins;b++) step = greatestCommonDivisor(step,bins[b]);
+
+  Metrics::Mark start = Metrics::mark();
   string chrom_names[N_CHROM_MAX];
   int    chrom_lens[N_CHROM_MAX];
   if (n_chroms == 0 || (n_chroms == 1 && user_chroms[0] == "")) {
@@ -2339,127 +2948,191 @@ void HisMaker::produceHistograms(string *user_chroms,int n_chroms,
     user_chroms = chrom_names;
   }
 
-  cout<<"Allocating memory ..."<<endl;
   int max = 0;
   for (int c = 0;c < n_chroms;c++) {
     int len = getChromLenWithTree(user_chroms[c],root_files[0]);
     if (len > max) max = len;
     chrom_lens[c] = len;
   }
-  char *seq_buffer = new char[max + 1000];
-  cout<<"Done."<<endl;
 
-  for (int c = 0;c < n_chroms;c++) {
-    string chrom = user_chroms[c];
-    cout<<"Calculating histograms with bin size of "<<bin_size<<" for '"
-	<<chrom<<"' ..."<<endl;
-    string name = Genome::makeCanonical(chrom);
-    int org_len = chrom_lens[c];
-    if (org_len <= 0) continue;
-    int n_bins = org_len/bin_size + 1;
-    int len = n_bins*bin_size;
-    TString h_name_u = getUSignalName(name,bin_size);
-    TString h_name_p = getSignalName(name,bin_size,false,useGCcorr);
-    TString h_title_u = "Unique read depth for "; h_title_u += name;
-    TString h_title_p = "Read depth for ";        h_title_p += name;
-    TH1 *his_rd_u = new TH1D(h_name_u,h_title_u,n_bins,0,len);
-    TH1 *his_rd_p = new TH1D(h_name_p,h_title_p,n_bins,0,len);
-    TH1 *his_gc = (TH1*)his_rd_p->Clone(getGCName(name,bin_size));
-    his_rd_u->SetDirectory(0);
-    his_rd_p->SetDirectory(0);
-    
-    for (int f = 0;f < n_root_files;f++) {
-      string rfn = root_files[f];
-      TFile file(rfn.c_str(),"Read");
-      if (file.IsZombie()) { 
-	cerr<<"Can't open file '"<<rfn<<"'."<<endl;
-	continue;
-      }
+  // Memory is allocated by each thread when it starts on first chromosome
+  ThreadPool pool(n_threads_);
+  int n_threads = pool.numThreads();
+  ChromosomeJobs jobs = ChromosomeJobs();
+  jobs.maker        = this;
+  jobs.pool         = &pool;
+  jobs.chroms       = user_chroms;
+  jobs.useGCcorr    = useGCcorr;
+  jobs.root_files   = root_files;
+  jobs.n_root_files = n_root_files;
+  jobs.chrom_lens   = chrom_lens;
+  jobs.bins         = bins;
+  jobs.n_bins       = n_bins;
+  jobs.step         = step;
+  jobs.max_len      = max;
+  jobs.counts       = new int*[n_threads];
+  jobs.seq_buffer   = new char*[n_threads];
+  for (int t = 0;t < n_threads;t++) {
+    jobs.counts[t]     = NULL;
+    jobs.seq_buffer[t] = NULL;
+  }
+  jobs.items = new long[n_chroms]();
+  GCAnnotation annotation(GCAnnotation::nameFor(dir_));
+  jobs.annotation = &annotation;
+  beginOutput();
+  pool.run(histogramsJob,&jobs,n_chroms);
+  endOutput();
+  if (metrics_)
+    metrics_->record("his","total","",start,sumItems(jobs,n_chroms));
+  delete[] jobs.items;
+
+  for (int t = 0;t < n_threads;t++) {
+    delete[] jobs.counts[t];
+    delete[] jobs.seq_buffer[t];
+  }
+  delete[] jobs.counts;
+  delete[] jobs.seq_buffer;
+}
 
-      // Calculating array with average RD for GC
-//       int loc_bin = 1000;
-//       TString loc_dir = getDirName(loc_bin);
-//       TH2 *fh_rd_gc = (TH2*)getHistogram("rd_gc_1000",rfn,loc_dir);
-//       TH1 *fh_mean  = getHistogram(getDistrName(chrAll,loc_bin,false,false),
-// 				   rfn,loc_dir);
-//       TH1 *fh_gc    = getHistogram(getGCName(name,loc_bin),rfn,loc_dir);
-//       int N = fh_rd_gc->GetNbinsX();
-//       double width = 100./(N - 1),inv_width = 1./width;
-//       double *gc_corr = new double[N];
-//       calcGCcorrection(fh_rd_gc,fh_mean,gc_corr,N);
-
-      TTree *tree = (TTree*)file.Get(chrom.c_str());
-      if (!tree) tree = (TTree*)file.Get(name.c_str());
-      if (!tree) {
-	cerr<<"Can't find tree for chromosome '"<<chrom<<"' in file '"
-	    <<rfn<<"'."<<endl;
-	continue;
-      }
-      
+void HisMaker::histogramsJob(int job,int thread,void *arg)
+{
+  ChromosomeJobs *jobs = (ChromosomeJobs*)arg;
+  jobs->maker->histogramsChromosome(jobs,job,thread);
+}
+
+void HisMaker::histogramsChromosome(ChromosomeJobs *jobs,int job,int thread)
+{
+  ThreadPool *pool = jobs->pool;
+  string chrom = jobs->chroms[job];
+  string name  = Genome::makeCanonical(chrom);
+  int org_len  = jobs->chrom_lens[job];
+  if (org_len <= 0) return;
+  int *bins = jobs->bins,n_bins = jobs->n_bins,step = jobs->step;
+  Metrics::Mark start = Metrics::mark(true);
+  long n_records = 0;
+
+  // Counts per step, GC and AT prefix sums, counts per bin
+  int n_max = jobs->max_len/step + 2;
+  int max_bins = jobs->max_len/bins[0] + 2;
+  for (int b = 1;b < n_bins;b++)
+    if (jobs->max_len/bins[b] + 2 > max_bins)
+      max_bins = jobs->max_len/bins[b] + 2;
+  if (!jobs->counts[thread]) {
+    pool->lock();
+    cout<<"Allocating memory ..."<<endl;
+    pool->unlock();
+    jobs->counts[thread]     = new int[4*n_max + 2*max_bins];
+    jobs->seq_buffer[thread] = new char[jobs->max_len + 1000];
+  }
+  int *step_p = jobs->counts[thread],*step_u = step_p + n_max;
+  int *gc_sum = step_u + n_max,*at_sum = gc_sum + n_max;
+  int *arr_p  = at_sum + n_max,*arr_u = arr_p + max_bins;
+  char *seq_buffer = jobs->seq_buffer[thread];
+
+  pool->lock();
+  cout<<"Calculating histograms with bin size of "<<bins[0];
+  for (int b = 1;b < n_bins;b++) cout<<", "<<bins[b];
+  cout<<" for '"<<chrom<<"' ..."<<endl;
+  pool->unlock();
+  int n_steps = org_len/step + 1;
+  memset(step_p,0,(n_steps + 1)*sizeof(int));
+  memset(step_u,0,(n_steps + 1)*sizeof(int));
+    
+  for (int f = 0;f < jobs->n_root_files;f++) {
+    string rfn = jobs->root_files[f];
+
+    // Counts in read depth file, if any, are used instead of tree
+    RDFile rdf(RDFile::nameFor(rfn));
+    int rdc = findRDChromosome(rdf,chrom);
+    if (rdc >= 0) {
+      rdf.seek(rdc);
       int position;
-      short rd_unique,rd_parity;
-      tree->SetBranchAddress("position", &position);
-      tree->SetBranchAddress("rd_unique",&rd_unique);
-      tree->SetBranchAddress("rd_parity",&rd_parity);
-      int start = 1, end = bin_size, bin = 0;
-      int n_ent = tree->GetEntries(), index = 0;
-      short count_unique = 0,count_parity = 0;
-      tree->GetEntry(index++);
-      while (index < n_ent) {
-	
-	// Calculate count
-	while (position <= end && index < n_ent) {
-	  count_unique += rd_unique;
-	  count_parity += rd_parity;
-	  tree->GetEntry(index++);
-	  if (count_unique < 0) count_unique = 30000;
-	  if (count_parity < 0) count_parity = 30000;
-	}
-	
-	bin++;
-	if (bin < 1 || bin > n_bins) {
-	  cerr<<"Bin out of bounds."<<endl;
-	} else {
-	  double cu = his_rd_u->GetBinContent(bin) + count_unique;
-	  double cp = his_rd_u->GetBinContent(bin) + count_parity;
-	  his_rd_u->SetBinContent(bin,cu);
-	  his_rd_p->SetBinContent(bin,cp);
-	}
-	
-	start += bin_size;
-	end   += bin_size;
-	count_unique   = 0;
-	count_parity   = 0;
+      unsigned int cp,cu;
+      while (rdf.next(position,cp,cu)) {
+	n_records++;
+	int i = (position > 0) ? (position - 1)/step + 1 : 1;
+	if (i > n_steps) continue;
+	step_p[i] += cp;
+	step_u[i] += cu;
       }
-      delete tree;
-      file.Close();
+      continue;
     }
 
-    // Writing chromosome specific histograms
-    writeHistogramsToBinDir(his_rd_u,his_rd_p);
-    
-    // Creating histograms with GC-content
-    cout<<"Making GC histogram for '"<<chrom<<"' ..."<<endl;
-    if (readChromosome(name,seq_buffer,org_len) != org_len) {
-      cerr<<"Read sequence is of different length from expectation."<<endl;
-      cerr<<"Doing nothing."<<endl;
-    } else {
-      int n = his_gc->GetNbinsX();
-      for (int i = 1;i <= n;i++) {
-	int low = (int) his_gc->GetBinLowEdge(i);
-	int up  = (int) (low + his_gc->GetBinWidth(i));
-	his_gc->SetBinContent(i,countGCpercentage(seq_buffer,low,up));
-      }
+    pool->lock();
+    TFile file(rfn.c_str(),"Read");
+    if (file.IsZombie()) { 
+      cerr<<"Can't open file '"<<rfn<<"'."<<endl;
+      pool->unlock();
+      continue;
+    }
+
+    TTree *tree = (TTree*)file.Get(chrom.c_str());
+    if (!tree) tree = (TTree*)file.Get(name.c_str());
+    if (!tree) {
+      cerr<<"Can't find tree for chromosome '"<<chrom<<"' in file '"
+	  <<rfn<<"'."<<endl;
+      pool->unlock();
+      continue;
+    }
       
-      writeHistogramsToBinDir(his_gc);
+    int position;
+    short rd_unique,rd_parity;
+    tree->SetBranchAddress("position", &position);
+    tree->SetBranchAddress("rd_unique",&rd_unique);
+    tree->SetBranchAddress("rd_parity",&rd_parity);
+    int n_ent = tree->GetEntries();
+    n_records += n_ent;
+    for (int ent = 0;ent < n_ent;ent++) {
+      tree->GetEntry(ent);
+      int i = (position > 0) ? (position - 1)/step + 1 : 1;
+      if (i > n_steps) continue;
+      step_p[i] += rd_parity;
+      step_u[i] += rd_unique;
     }
-    // Deleting objects
-    delete his_rd_u;
-    delete his_rd_p;
-    delete his_gc;
+    delete tree;
+    file.Close();
+    pool->unlock();
   }
 
-  delete[] seq_buffer;
+  if (metrics_) metrics_->record("his","count",chrom,start,n_records);
+
+  // Counting GC and AT once for all bin sizes
+  Metrics::Mark phase = Metrics::mark(true);
+  pool->lock();
+  cout<<"Making GC histogram for '"<<chrom<<"' ..."<<endl;
+  pool->unlock();
+  const signed char *gc_percent[n_bins];
+  bool annotated = readGCAnnotation(jobs->annotation,name,org_len,
+				    bins,n_bins,gc_percent);
+  bool has_seq = annotated ||
+    readGCandAT(name,org_len,step,seq_buffer,gc_sum,at_sum);
+  if (!has_seq) {
+    pool->lock();
+    cerr<<"Read sequence is of different length from expectation."<<endl;
+    cerr<<"No GC histogram is made."<<endl;
+    pool->unlock();
+  }
+  if (metrics_) metrics_->record("his","gc",chrom,phase,org_len);
+
+  long n_binned = 0;
+  for (int b = 0;b < n_bins;b++) {
+    int n = org_len/bins[b] + 1,k = bins[b]/step;
+    n_binned += n;
+    for (int i = 1,s = 1;i <= n;i++) {
+      arr_p[i] = arr_u[i] = 0;
+      for (int e = i*k;s <= e && s <= n_steps;s++) {
+	arr_p[i] += step_p[s];
+	arr_u[i] += step_u[s];
+      }
+    }
+    pool->lock();
+    writeBinnedHistograms(name,org_len,bins[b],arr_p,arr_u,
+			  has_seq ? gc_sum : NULL,at_sum,step,
+			  jobs->useGCcorr,annotated ? gc_percent[b] : NULL);
+    pool->unlock();
+  }
+  jobs->items[job] = n_binned;
+  if (metrics_) metrics_->record("his","chromosome",chrom,start,n_binned);
 }
 
 double getMedian(TH1 *tmp)
@@ -2828,37 +3501,37 @@ void HisMaker::aggregate(string *files,int n_files,string *chroms,int n_chroms)
   static const int RANGE = 550;
   TH1 *his_frg_len = makeFrgLenHis(files,n_files,2*RANGE);
 
-  char  *seq_buffer = new char[250000000];
-  int   *at_starts  = new int[900000];
-  int   *at_ends    = new int[900000];
-  int   *gc_starts  = new int[400000];
-  int   *gc_ends    = new int[400000];
+  // Runs of AT and GC from reference annotation, if there is one, or
+  // from sequence
+  GCAnnotation annotation(GCAnnotation::nameFor(dir_));
+  vector<int> at_s,at_e,gc_s,gc_e;
   for (int chr = 0;chr < n_chroms;chr++) {
     string name = Genome::makeCanonical(chroms[chr]);
     cout<<"Aggregating for "<<name<<" ..."<<endl;
-    int atn = 0,gcn = 0;
-    int len_seq = readChromosome(name,seq_buffer,250000000);
-    for (int i = 0;i < len_seq;i++) {
-      char c;
-      int ats = i,ate = i;
-      while (i < len_seq && (c = seq_buffer[i]) &&
-	     (c == 'A' || c == 'a' || c == 'T' || c == 't')) ate = i++;
-      
-      int at_len = ate - ats + 1;
-      if (at_len >= 10) {
-	at_starts[atn] = ats + 1;
-	at_ends[atn]   = ate + 1;
-	atn++;
-      }
-      int gcs = i,gce = i;
-      while (i < len_seq && (c = seq_buffer[i]) &&
-	     (c == 'C' || c == 'c' || c == 'G' || c == 'g')) gce = i++;
-      if (gce - gcs + 1 >= 10) {
-	gc_starts[gcn] = gcs + 1;
-	gc_ends[gcn]   = gce + 1;
-	gcn++;
+    int ci = annotation.chromIndex(name),atn,gcn;
+    const int *at_starts,*at_ends,*gc_starts,*gc_ends;
+    if (ci >= 0 && annotation.isCurrent(ci,sequenceFile(name))) {
+      atn = annotation.numATRuns(ci);
+      gcn = annotation.numGCRuns(ci);
+      at_starts = annotation.atStarts(ci);
+      at_ends   = annotation.atEnds(ci);
+      gc_starts = annotation.gcStarts(ci);
+      gc_ends   = annotation.gcEnds(ci);
+    } else {
+      int max_len = sequenceLength(name),len_seq = 0;
+      char *seq_buffer = NULL;
+      if (max_len > 0) {
+	seq_buffer = new char[max_len];
+	len_seq = readChromosome(name,seq_buffer,max_len);
       }
-      if (i > ats) i--;
+      GCAnnotation::findRuns(seq_buffer,len_seq,at_s,at_e,gc_s,gc_e);
+      atn = at_s.size();
+      gcn = gc_s.size();
+      at_starts = atn > 0 ? &at_s[0] : NULL;
+      at_ends   = atn > 0 ? &at_e[0] : NULL;
+      gc_starts = gcn > 0 ? &gc_s[0] : NULL;
+      gc_ends   = gcn > 0 ? &gc_e[0] : NULL;
+      delete[] seq_buffer;
     }
 
     cout<<atn<<" "<<gcn<<endl;
@@ -2886,7 +3559,7 @@ void HisMaker::aggregate(string *files,int n_files,string *chroms,int n_chroms)
       int n_ent = tree->GetEntries();
       for (int ent = 0;ent < n_ent;ent++) {
 	tree->GetEntry(ent);
-	while (position > at_ends[ati] + WIN && ati < atn) ati++;
+	while (ati < atn && position > at_ends[ati] + WIN) ati++;
 	double p5 = 1,p3 = 1,range_over = 1./RANGE,add5 = 0,add3 = 0;
 	int offset = 0;
 	for (int i = ati;i < atn;i++) {
@@ -2937,7 +3610,7 @@ void HisMaker::aggregate(string *files,int n_files,string *chroms,int n_chroms)
  	  if (val > 0) rdp = rd_parity/val;
 	  his_AT_corr->SetBinContent(x,y,his_AT_corr->GetBinContent(x,y) + rdp);
 	}
-	while (position > gc_ends[gci] + WIN && gci < gcn) gci++;
+	while (gci < gcn && position > gc_ends[gci] + WIN) gci++;
 	for (int j = gci;j < gcn;j++) {
 	  if (position < gc_starts[j] - WIN) break;
 	  int len = gc_ends[j] - gc_starts[j] + 1;
@@ -2956,12 +3629,6 @@ void HisMaker::aggregate(string *files,int n_files,string *chroms,int n_chroms)
   }
 
   writeHistograms(his_AT_aggr,his_AT_corr,his_GC_aggr,his_frg_len);
-  
-  delete[] seq_buffer;
-  delete[] at_starts;
-  delete[] at_ends; 
-  delete[] gc_starts;
-  delete[] gc_ends; 
 }
 
 void HisMaker::mergeTrees(string *user_chroms,int n_chroms,
@@ -2980,43 +3647,136 @@ void HisMaker::mergeTrees(string *user_chroms,int n_chroms,
     user_chroms    = chrom_names;
   }
 
-  cout<<"Allocating memory ..."<<endl;
-  int max = 0;
-  for (int c = 0;c < n_chroms;c++) {
-    int len = getChromLenWithTree(user_chroms[c],user_files[0]);
-    if (len > max) max = len;
-    chrom_lens[c] = len;
-  }
-  short *counts_u = new short[max + 1];
-  short *counts_p = new short[max + 1];
+  for (int c = 0;c < n_chroms;c++)
+    chrom_lens[c] = getChromLenWithTree(user_chroms[c],user_files[0]);
   for (int c = 0;c < n_chroms;c++) {
     if (chrom_lens[c] <= 0) continue;
     string chrom = user_chroms[c];
     cout<<"Merging trees for '"<<chrom<<"' ..."<<endl;
-    memset(counts_u,0,(max + 1)*sizeof(short));
-    memset(counts_p,0,(max + 1)*sizeof(short));
+    SparseCounts counts_u(chrom_lens[c]),counts_p(chrom_lens[c]);
     for (int f = 0;f < n_files;f++) {
       cout<<"Readng tree "<<chrom<<" from file '"<<user_files[f]
 	  <<"' ..."<<endl;
-      readTreeForChromosome(user_files[f],chrom,counts_p,counts_u);
+      readTreeForChromosome(user_files[f],chrom,&counts_p,&counts_u);
     }
     cout<<"Filling and saving tree for '"<<chrom<<"' ..."<<endl;
-    writeTreeForChromosome(chrom,&counts_p[1],&counts_u[1],chrom_lens[c]);
+    writeTreeForChromosome(chrom,&counts_p,&counts_u,chrom_lens[c]);
   }
-  delete[] counts_u;
-  delete[] counts_p;
+}
+
+void HisMaker::prepareReference(string *user_chroms,int n_chroms,
+				int *bins,int n_bins)
+{
+  if (user_chroms == NULL && n_chroms != 0) {
+    cerr<<"No chromosome names given."<<endl
+	<<"Aborting annotating reference."<<endl;
+    return;
+  }
+  if (bins == NULL || n_bins <= 0) {
+    cerr<<"No bin sizes given."<<endl
+	<<"Aborting annotating reference."<<endl;
+    return;
+  }
+  for (int b = 0;b < n_bins;b++)
+    if (bins[b] <= 0) {
+      cerr<<"Bin size must be positive."<<endl
+	  <<"Aborting annotating reference."<<endl;
+      return;
+    }
+
+  // Chromosomes of genome or, if not given, of reference or all fasta
+  // files in directory
+  string chrom_names[N_CHROM_MAX];
+  if (n_chroms == 0 || (n_chroms == 1 && user_chroms[0] == "")) {
+    n_chroms = 0;
+    if (refGenome_) {
+      for (int c = 0;c < refGenome_->numChrom() && c < N_CHROM_MAX;c++)
+	chrom_names[n_chroms++] = refGenome_->chromName(c);
+    } else if (fasta_) {
+      for (int c = 0;c < fasta_->numChrom() && c < N_CHROM_MAX;c++)
+	chrom_names[n_chroms++] = fasta_->chromName(c);
+    } else if (DIR *dir = opendir(dir_.c_str())) {
+      while (dirent *ent = readdir(dir)) {
+	string name = ent->d_name;
+	int len = name.length();
+	if (len <= 3 || name.substr(len - 3,3) != ".fa") continue;
+	if (n_chroms >= N_CHROM_MAX) {
+	  cerr<<"Too many fasta files in directory '"<<dir_<<"'."<<endl
+	      <<"File '"<<name<<"' is ignored."<<endl;
+	  continue;
+	}
+	chrom_names[n_chroms++] = name.substr(0,len - 3);
+      }
+      closedir(dir);
+    }
+    if (n_chroms == 0) {
+      cerr<<"Can't find any chromosomes to annotate."<<endl;
+      return;
+    }
+    user_chroms = chrom_names;
+  }
+
+  ThreadPool pool(n_threads_);
+  ChromosomeJobs jobs = ChromosomeJobs();
+  jobs.maker  = this;
+  jobs.pool   = &pool;
+  jobs.chroms = user_chroms;
+  jobs.bins   = bins;
+  jobs.n_bins = n_bins;
+  GCAnnotation::Writer writer(GCAnnotation::nameFor(dir_));
+  if (!writer.isOpen()) return;
+  jobs.writer = &writer;
+  pool.run(prepareReferenceJob,&jobs,n_chroms);
+  writer.close();
+}
+
+void HisMaker::prepareReferenceJob(int job,int thread,void *arg)
+{
+  ChromosomeJobs *jobs = (ChromosomeJobs*)arg;
+  jobs->maker->prepareReferenceChromosome(jobs,job,thread);
+}
+
+void HisMaker::prepareReferenceChromosome(ChromosomeJobs *jobs,
+					  int job,int thread)
+{
+  ThreadPool *pool = jobs->pool;
+  string name  = Genome::makeCanonical(jobs->chroms[job]);
+  int max_len  = sequenceLength(name);
+  if (max_len < 0) {
+    pool->lock();
+    cerr<<"Can't find sequence of '"<<name<<"'."<<endl;
+    pool->unlock();
+    return;
+  }
+
+  pool->lock();
+  cout<<"Annotating '"<<name<<"' ..."<<endl;
+  pool->unlock();
+  char *seq = new char[max_len];
+  int len = readChromosome(name,seq,max_len);
+  GCAnnotation::Data data;
+  if (len > 0) GCAnnotation::annotate(seq,len,jobs->bins,jobs->n_bins,data);
+  delete[] seq;
+  if (len <= 0) return;
+
+  pool->lock();
+  jobs->writer->add(name,sequenceFile(name),data);
+  pool->unlock();
 }
 
 int HisMaker::getChromNamesWithTree(string *names,string rfn)
 {
   if (!names) return 0;
   if (rfn.length() == 0) rfn = root_file_name;
+  int ret = 0;
+  RDFile rdf(RDFile::nameFor(rfn));
+  for (int c = 0;c < rdf.numChrom() && ret < N_CHROM_MAX;c++)
+    names[ret++] = rdf.chromName(c);
   TFile file(rfn.c_str(),"Read");
   if (file.IsZombie()) { 
-    cerr<<"Can't open file '"<<root_file_name<<"'."<<endl;
-    return 0;
+    if (ret == 0) cerr<<"Can't open file '"<<root_file_name<<"'."<<endl;
+    return ret;
   }
-  int ret = 0;
   TIterator *it = file.GetListOfKeys()->MakeIterator();
   while (TKey *key = (TKey*)it->Next()) {
     TObject *obj = key->ReadObj();
@@ -3026,6 +3786,7 @@ int HisMaker::getChromNamesWithTree(string *names,string rfn)
       cerr<<"Tree with no name is ignored."<<endl;
       continue;
     }
+    if (findRDChromosome(rdf,chrom) >= 0) continue;
     if (ret >= N_CHROM_MAX) {
       cerr<<"Too many trees in the file '"<<root_file_name<<"'."<<endl
 	  <<"Tree '"<<chrom<<"' is ignored."<<endl;
@@ -3042,12 +3803,17 @@ int HisMaker::getChromLenWithTree(string chrom,string rfn)
   int len = 0;
   string name  = Genome::makeCanonical(chrom);
   if (rfn.length() == 0) rfn = root_file_name;
-  TFile file(rfn.c_str(),"Read");
-  if (!file.IsZombie()) { 
-    TTree *tree = (TTree*) file.Get(name.c_str());
-    if (tree) len = parseChromosomeLength(tree->GetTitle());
+  RDFile rdf(RDFile::nameFor(rfn));
+  int rdc = findRDChromosome(rdf,chrom);
+  if (rdc >= 0) len = rdf.chromLen(rdc);
+  else {
+    TFile file(rfn.c_str(),"Read");
+    if (!file.IsZombie()) { 
+      TTree *tree = (TTree*) file.Get(name.c_str());
+      if (tree) len = parseChromosomeLength(tree->GetTitle());
+    }
+    file.Close();
   }
-  file.Close();
 
   if (len <= 0) {
     cerr<<"Can't determine length for '"<<chrom<<"'."<<endl;
@@ -3105,9 +3871,115 @@ int findIndex(string *arr,int n,string name)
   return -1;
 }
 
+// Read counts per chromosome. Either per base (to make trees) or, if
+// n_bins > 0, per bin for each of bin sizes (to make histograms directly).
+struct ReadCounts
+{
+  SparseCounts **p,**u; // Per base
+  int     n_bins,*bins; // Bin sizes
+  int  ***bin_p,***bin_u; // Per chromosome, bin size and bin
+};
+
+// Counts read, which parser is at, for chromosome with index chr_ind.
+// Read and fragment lengths are counted per bin of his_frg_read.
+bool countRead(AliParser *parser,int chr_ind,int *clens,
+	       ReadCounts *counts,bool forUnique,
+	       TH2 *his_frg_read,int *frg_read,ThreadPool *pool = NULL)
+{
+  int mid = abs(parser->getStart() + parser->getEnd())>>1;
+  if (mid < 0 || mid > clens[chr_ind]) {
+    if (pool) pool->lock();
+    cerr<<"Out of bound coordinate "<<mid<<" for '"
+	<<parser->getChromosome()<<"'."<<endl;
+    if (pool) pool->unlock();
+    return false;
+  }
+
+  // Doing counting
+  bool unique = forUnique && !parser->isQ0();
+  if (counts->n_bins > 0) {
+    // Same binning as in produceHistograms(); mid = 0 is not in trees
+    if (mid > 0)
+      for (int b = 0;b < counts->n_bins;b++) {
+	int bin = (mid - 2)/counts->bins[b] + 1;
+	counts->bin_p[chr_ind][b][bin]++;
+	if (unique) counts->bin_u[chr_ind][b][bin]++;
+      }
+  } else {
+    counts->p[chr_ind]->add(mid);
+    if (unique) counts->u[chr_ind]->add(mid);
+  }
+
+  int frg_len = parser->getFragmentLength();
+  if (frg_len < 0) frg_len = -frg_len;
+  frg_read[his_frg_read->FindFixBin(parser->getReadLength(),frg_len)]++;
+
+  return true;
+}
+
+// Data shared by threads making trees from indexed bam file
+struct TreeData
+{
+  string      file;
+  bool        forUnique;
+  int        *clens,*reindex,n_tids;
+  ReadCounts *counts;
+  int        *jobs,n_jobs; // Chromosome indexes, longest first
+  TH2        *his_frg_read;
+  int       **frg_read;    // Per thread
+  long       *n_placed;    // Per thread
+  AliParser **parsers;     // Per thread
+  ThreadPool *pool;
+  string     *cnames;
+  Metrics    *metrics;     // NULL if not collected
+};
+
+void makeTreeForChromosome(int job,int thread,void *arg)
+{
+  TreeData *data = (TreeData*)arg;
+  AliParser *parser = data->parsers[thread];
+  if (!parser) {
+    parser = data->parsers[thread] = new AliParser(data->file.c_str(),true);
+    parser->setCoreOnly(true);
+  }
+  int chr_ind = data->jobs[job];
+  Metrics::Mark start = Metrics::mark(true);
+  long n_placed = data->n_placed[thread];
+  // Several contigs in bam can map onto the same chromosome
+  for (int tid = 0;tid < data->n_tids;tid++) {
+    if (data->reindex[tid] != chr_ind) continue;
+    if (!parser->setRegion(tid)) {
+      data->pool->lock();
+      cerr<<"Can't query '"<<parser->chromName(tid)<<"' in file '"
+	  <<data->file<<"'."<<endl;
+      data->pool->unlock();
+      continue;
+    }
+    while (parser->parseRecord()) {
+      if (parser->isUnmapped())  continue;
+      if (parser->isDuplicate()) continue;
+      if (parser->getChromosomeIndex() != tid) continue;
+      if (countRead(parser,chr_ind,data->clens,
+		    data->counts,data->forUnique,
+		    data->his_frg_read,data->frg_read[thread],data->pool))
+	data->n_placed[thread]++;
+    }
+  }
+  if (data->metrics)
+    data->metrics->record("tree","parse",data->cnames[chr_ind],start,
+			  data->n_placed[thread] - n_placed);
+}
+
+// Reads placed so far, by main thread and by threads of pool
+long totalPlaced(long n_placed,long *n_placed_thread,int n_threads)
+{
+  for (int t = 0;t < n_threads;t++) n_placed += n_placed_thread[t];
+  return n_placed;
+}
+
 void HisMaker::produceTrees(string *user_chroms,int n_chroms,
 			    string *user_files,int n_files,
-			    bool forUnique)
+			    bool forUnique,int *bins,int n_bins)
 {
   string one_string[1] = {""};
   if (user_chroms == NULL) n_chroms = 0;
@@ -3118,14 +3990,18 @@ void HisMaker::produceTrees(string *user_chroms,int n_chroms,
 
   string cnames[N_CHROM_MAX];
   int    clens[N_CHROM_MAX],reindex[N_CHROM_MAX],ncs = 0,atlens[N_CHROM_MAX];
-  short *counts_u[N_CHROM_MAX],*counts_p[N_CHROM_MAX];
+  SparseCounts *counts_u[N_CHROM_MAX],*counts_p[N_CHROM_MAX];
+  int  **bin_u[N_CHROM_MAX],**bin_p[N_CHROM_MAX];
   int   *at_se[N_CHROM_MAX];
   for (int i = 0;i < N_CHROM_MAX;i++) {
     counts_u[i] = counts_p[i] = NULL;
+    bin_u[i] = bin_p[i] = NULL;
     at_se[i] = NULL;
     atlens[i] = -1;
   }
   THashTable unknown;
+  if (bins == NULL) n_bins = 0;
+  ReadCounts counts = { counts_p,counts_u,n_bins,bins,bin_p,bin_u };
 
   static const int WIN = 2000;
   TH2 *his_at_aggr  = new TH2I("his_at_aggr","AT aggregation",51,9.5,60.5,
@@ -3138,17 +4014,36 @@ void HisMaker::produceTrees(string *user_chroms,int n_chroms,
 			       2*win + 1,-win - 0.5,win + 0.5,
 			       2*win + 1,-win - 0.5,win + 0.5);
   
+  // Threads fill their own copies of read and fragment length counts
+  ThreadPool pool(n_threads_);
+  int n_cells = (his_frg_read->GetNbinsX() + 2)*
+    (his_frg_read->GetNbinsY() + 2);
+  int *frg_read[pool.numThreads()];
+  long n_placed_thread[pool.numThreads()];
+  for (int t = 0;t < pool.numThreads();t++) {
+    frg_read[t] = new int[n_cells];
+    memset(frg_read[t],0,n_cells*sizeof(int));
+    n_placed_thread[t] = 0;
+  }
 
   long n_placed = 0;
   int ati = 0;
+  Metrics::Mark start = Metrics::mark();
   for (int f = 0;f < n_files;f++) {
+    Metrics::Mark parse_start = Metrics::mark();
+    long placed_before = totalPlaced(n_placed,n_placed_thread,
+				     pool.numThreads());
 
     if (user_files[f].length() > 0)
       cout<<"Parsing file "<<user_files[f]<<" ..."<<endl;
     else 
       cout<<"Parsing stdin ..."<<endl;
 
-    AliParser *parser = new AliParser(user_files[f].c_str());
+    int len = user_files[f].length();
+    bool loadIndex = pool.numThreads() > 1 &&
+      len > 3 && user_files[f].substr(len - 3,3) == "bam";
+    AliParser *parser = new AliParser(user_files[f].c_str(),loadIndex);
+    parser->setCoreOnly(true); // Only coordinates, flags and lengths are used
     bool use_ref = false;
     if (parser->numChrom() == 0) {
       use_ref = true;
@@ -3200,18 +4095,73 @@ void HisMaker::produceTrees(string *user_chroms,int n_chroms,
     }
 
     cout<<"Allocating memory ..."<<endl;
-    for (int c = 0;c < ncs;c++) {
-      if (!counts_p[c]) {
-	counts_p[c] = new short[clens[c] + 1];
-	memset(counts_p[c],0,(clens[c] + 1)*sizeof(short));
-      }
-      if (forUnique && !counts_u[c]) {
-	counts_u[c] = new short[clens[c] + 1];
-	memset(counts_u[c],0,(clens[c] + 1)*sizeof(short));
+    for (int c = 0;c < ncs && n_bins > 0;c++) {
+      if (bin_p[c]) continue;
+      bin_p[c] = new int*[n_bins];
+      bin_u[c] = new int*[n_bins];
+      for (int b = 0;b < n_bins;b++) {
+	int n = clens[c]/bins[b] + 2;
+	bin_p[c][b] = new int[n];
+	memset(bin_p[c][b],0,n*sizeof(int));
+	bin_u[c][b] = NULL;
+	if (!forUnique) continue;
+	bin_u[c][b] = new int[n];
+	memset(bin_u[c][b],0,n*sizeof(int));
       }
     }
+    for (int c = 0;c < ncs && n_bins == 0;c++) {
+      if (!counts_p[c]) counts_p[c] = new SparseCounts(clens[c]);
+      if (forUnique && !counts_u[c]) counts_u[c] = new SparseCounts(clens[c]);
+    }
     cout<<"Done."<<endl;
 
+    if (!use_ref && parser->isBam() && parser->hasIndex()) {
+      // Chromosomes are independent -- parse them in parallel
+      int jobs[N_CHROM_MAX],n_jobs = 0;
+      bool used[N_CHROM_MAX];
+      for (int c = 0;c < ncs;c++) used[c] = false;
+      for (int c = 0;c < parser->numChrom();c++)
+	if (reindex[c] >= 0 && !used[reindex[c]]) {
+	  used[reindex[c]] = true;
+	  jobs[n_jobs++] = reindex[c];
+	}
+      for (int i = 1;i < n_jobs;i++) // Longest first
+	for (int j = i;j > 0 && clens[jobs[j]] > clens[jobs[j - 1]];j--) {
+	  int tmp = jobs[j]; jobs[j] = jobs[j - 1]; jobs[j - 1] = tmp;
+	}
+      cout<<"Parsing "<<n_jobs<<" chromosomes/contigs using "
+	  <<pool.numThreads()<<" threads ..."<<endl;
+      AliParser *parsers[pool.numThreads()];
+      parsers[0] = parser;
+      for (int t = 1;t < pool.numThreads();t++) parsers[t] = NULL;
+      TreeData data;
+      data.file         = user_files[f];
+      data.forUnique    = forUnique;
+      data.clens        = clens;
+      data.reindex      = reindex;
+      data.n_tids       = parser->numChrom();
+      data.counts       = &counts;
+      data.jobs         = jobs;
+      data.n_jobs       = n_jobs;
+      data.his_frg_read = his_frg_read;
+      data.frg_read     = frg_read;
+      data.n_placed     = n_placed_thread;
+      data.parsers      = parsers;
+      data.pool         = &pool;
+      data.cnames       = cnames;
+      data.metrics      = metrics_;
+      pool.run(makeTreeForChromosome,&data,n_jobs);
+      for (int t = 1;t < pool.numThreads();t++) delete parsers[t];
+      delete parser;
+      if (metrics_)
+	metrics_->record("tree","parse","",parse_start,
+			 totalPlaced(n_placed,n_placed_thread,
+				     pool.numThreads()) - placed_before);
+      continue;
+    }
+
+    // Reading sequentially -- decompress ahead in other threads instead
+    parser->setNumThreads(pool.numThreads());
     int    prev_chr_ind = -1,chr_ind;
     string prev_chr("");
     while (parser->parseRecord()) {
@@ -3235,22 +4185,10 @@ void HisMaker::produceTrees(string *user_chroms,int n_chroms,
       if (chr_ind < 0) continue;
       chr_ind = reindex[chr_ind];
       if (chr_ind < 0 || chr_ind >= ncs) continue;
-      int mid = abs(parser->getStart() + parser->getEnd())>>1;
-      if (mid < 0 || mid > clens[chr_ind]) {
-	cerr<<"Out of bound coordinate "<<mid<<" for '"
-	    <<parser->getChromosome()<<"'."<<endl;
+      if (!countRead(parser,chr_ind,clens,&counts,forUnique,
+		     his_frg_read,frg_read[0]))
 	continue;
-      }
-
-      // Doing counting
-      if (counts_p[chr_ind][mid] + 1 > 0) counts_p[chr_ind][mid]++;
-      if (forUnique && !parser->isQ0())
-	if (counts_u[chr_ind][mid] + 1 > 0) counts_u[chr_ind][mid]++;
       n_placed++;
-      
-      int frg_len = parser->getFragmentLength();
-      if (frg_len < 0) his_frg_read->Fill(parser->getReadLength(),-frg_len);
-      else             his_frg_read->Fill(parser->getReadLength(), frg_len);
 
 //       // Parsing AT runs
 //       if (atlens[chr_ind] < 0) {
@@ -3299,33 +4237,101 @@ void HisMaker::produceTrees(string *user_chroms,int n_chroms,
       prev_chr_ind = chr_ind;
     }
     delete parser;
+    if (metrics_)
+      metrics_->record("tree","parse","",parse_start,
+		       totalPlaced(n_placed,n_placed_thread,
+				   pool.numThreads()) - placed_before);
   }
 
   for (int c = 0;c < ncs;c++) 
     if (counts_p[c]) {
+      Metrics::Mark phase = Metrics::mark(true);
       cout<<"Filling and saving tree for '"<<cnames[c]<<"' ..."<<endl;
-      short *arru = NULL, *arrp = NULL;
-      if (counts_u[c]) arru = &counts_u[c][1];
-      if (counts_p[c]) arrp = &counts_p[c][1];
-      writeTreeForChromosome(cnames[c],arrp,arru,clens[c]);
+      writeTreeForChromosome(cnames[c],counts_p[c],counts_u[c],clens[c]);
+      if (metrics_) metrics_->record("tree","write",cnames[c],phase);
+    }
+
+  if (n_bins > 0) {
+    int max = 0;
+    for (int c = 0;c < ncs;c++) if (clens[c] > max) max = clens[c];
+    int step = bins[0];
+    for (int b = 1;b < n_bins;b++) step = greatestCommonDivisor(step,bins[b]);
+    char *seq_buffer = new char[max + 1000];
+    int *gc_sum = new int[max/step + 2],*at_sum = new int[max/step + 2];
+    GCAnnotation annotation(GCAnnotation::nameFor(dir_));
+    const signed char *gc_percent[n_bins];
+    for (int c = 0;c < ncs;c++) {
+      if (!bin_p[c]) continue;
+      Metrics::Mark phase = Metrics::mark(true);
+      long n_binned = 0;
+      cout<<"Making GC histograms for '"<<cnames[c]<<"' ..."<<endl;
+      bool annotated = readGCAnnotation(&annotation,cnames[c],clens[c],
+					bins,n_bins,gc_percent);
+      bool has_seq = annotated ||
+	readGCandAT(cnames[c],clens[c],step,seq_buffer,gc_sum,at_sum);
+      if (!has_seq) {
+	cerr<<"Read sequence is of different length from expectation."<<endl;
+	cerr<<"No GC histograms are made."<<endl;
+      }
+      for (int b = 0;b < n_bins;b++) {
+	cout<<"Saving histograms with bin size of "<<bins[b]<<" for '"
+	    <<cnames[c]<<"' ..."<<endl;
+	writeBinnedHistograms(cnames[c],clens[c],bins[b],
+			      bin_p[c][b],bin_u[c][b],
+			      has_seq ? gc_sum : NULL,at_sum,step,
+			      false,annotated ? gc_percent[b] : NULL);
+	n_binned += clens[c]/bins[b] + 1;
+      }
+      if (metrics_) metrics_->record("tree","write",cnames[c],phase,n_binned);
     }
+    delete[] seq_buffer;
+    delete[] gc_sum;
+    delete[] at_sum;
+  }
+
+  // Merging counts from threads
+  for (int t = 0;t < pool.numThreads();t++) {
+    for (int i = 0;i < n_cells;i++)
+      if (frg_read[t][i] > 0) his_frg_read->AddBinContent(i,frg_read[t][i]);
+    n_placed += n_placed_thread[t];
+    delete[] frg_read[t];
+  }
+  his_frg_read->ResetStats();
+  his_frg_read->SetEntries(n_placed);
 
   cout<<"Writing histograms ... "<<endl;
   writeHistograms(his_frg_read,his_at_aggr,his_pair_pos);
 
   for (int c = 0;c < ncs;c++) {
-    delete[] counts_u[c];
-    delete[] counts_p[c];
+    delete counts_u[c];
+    delete counts_p[c];
     delete[] at_se[c];
+    for (int b = 0;b < n_bins && bin_p[c];b++) {
+      delete[] bin_p[c][b];
+      delete[] bin_u[c][b];
+    }
+    delete[] bin_p[c];
+    delete[] bin_u[c];
   }
 
   cout<<"Total of "<<n_placed<<" reads were placed."<<endl;
+  if (metrics_) metrics_->record("tree","total","",start,n_placed);
 }
 
-void HisMaker::writeTreeForChromosome(string chrom,short *arr_p,
-				      short *arr_u,int len)
+// Writes counts for positions 1 .. len as tree entries for positions
+// 0 .. len - 1. Counts above the range of short are split over several
+// entries with the same position, which readers sum up.
+void HisMaker::writeTreeForChromosome(string chrom,SparseCounts *counts_p,
+				      SparseCounts *counts_u,int len)
 {
+  if (write_rd_) {
+    RDFile::write(RDFile::nameFor(root_file_name.Data()),chrom,len,
+		  counts_p,counts_u);
+    return;
+  }
+
   // Creating a tree
+  cache_.closeFile(root_file_name);
   TFile file(root_file_name.Data(),"Update");
   if (file.IsZombie()) {
     cerr<<"Can't open/write to file '"<<root_file_name<<"'."<<endl;
@@ -3341,13 +4347,17 @@ void HisMaker::writeTreeForChromosome(string chrom,short *arr_p,
   tree->Branch("position", &position, "position/I");
   tree->Branch("rd_unique",&rd_u,"rd_u/S");
   tree->Branch("rd_parity",&rd_p,"rd_p/S");
-  // Filling the tree
-  for (int i = 0;i < len;i++) {
-    //if (i%100000 == 0) cout<<i<<endl;
-    rd_u = (arr_u) ? arr_u[i] : 0;
-    rd_p = (arr_p) ? arr_p[i] : 0;
-    if (rd_u > 0 || rd_p > 0) {
-      position = i;
+  // Filling the tree, merging positions with counts from both containers
+  static const unsigned int MAX_COUNT = 32767;
+  SparseCountsPair counts(counts_p,counts_u);
+  int pos;
+  unsigned int cp,cu;
+  while (counts.next(pos,cp,cu)) {
+    if (pos < 1 || pos > len) continue;
+    position = pos - 1;
+    while (cp > 0 || cu > 0) {
+      rd_p = (cp > MAX_COUNT) ? MAX_COUNT : cp; cp -= rd_p;
+      rd_u = (cu > MAX_COUNT) ? MAX_COUNT : cu; cu -= rd_u;
       tree->Fill();
     }
   }
@@ -3360,9 +4370,75 @@ void HisMaker::writeTreeForChromosome(string chrom,short *arr_p,
   file.Close();
 }
   
+// Writes read depth histograms with bin size bin made from counts per bin
+// arr_p and arr_u (indexed from 1). GC histogram is made if gc_sum is
+// given, from prefix sums of GC and AT over chunks of step bases (see
+// sumGCandAT()); bin size must be multiple of step. Or, GC histogram is
+// made from GC percentage per bin gc_percent (see GCAnnotation).
+void HisMaker::writeBinnedHistograms(string chrom,int org_len,int bin,
+				     int *arr_p,int *arr_u,
+				     int *gc_sum,int *at_sum,int step,
+				     bool useGCcorr,
+				     const signed char *gc_percent)
+{
+  int n_bins = org_len/bin + 1;
+  int len = n_bins*bin;
+  TString h_title_u = "Unique read depth for "; h_title_u += chrom;
+  TString h_title_p = "Read depth for ";        h_title_p += chrom;
+  TH1 *his_rd_u = new TH1D(getUSignalName(chrom,bin),h_title_u,n_bins,0,len);
+  TH1 *his_rd_p = new TH1D(getSignalName(chrom,bin,false,useGCcorr),h_title_p,
+			   n_bins,0,len);
+  his_rd_u->SetDirectory(0);
+  his_rd_p->SetDirectory(0);
+  for (int i = 1;i <= n_bins;i++) {
+    his_rd_p->SetBinContent(i,arr_p[i]);
+    if (arr_u) his_rd_u->SetBinContent(i,arr_u[i]);
+  }
+  TH1 *his_gc = NULL;
+  if (gc_percent) {
+    his_gc = (TH1*)his_rd_p->Clone(getGCName(chrom,bin));
+    his_gc->Reset();
+    for (int i = 1;i <= n_bins;i++) his_gc->SetBinContent(i,gc_percent[i - 1]);
+  } else if (gc_sum) {
+    his_gc = (TH1*)his_rd_p->Clone(getGCName(chrom,bin));
+    his_gc->Reset();
+    int n_chunks = (org_len + step - 1)/step,k = bin/step;
+    for (int i = 1;i <= n_bins;i++) {
+      int s = (i - 1)*k,e = i*k;
+      if (s > n_chunks) s = n_chunks;
+      if (e > n_chunks) e = n_chunks;
+      int n_gc = gc_sum[e] - gc_sum[s],n_total = n_gc + at_sum[e] - at_sum[s];
+      if (n_total == 0) his_gc->SetBinContent(i,-100);
+      else his_gc->SetBinContent(i,int(n_gc*100./n_total + 0.5));
+    }
+  }
+
+  TString tmp = dir_name;
+  dir_name = getDirName(bin);
+  writeHistogramsToBinDir(his_rd_u,his_rd_p,his_gc);
+  dir_name = tmp;
+
+  delete his_rd_u;
+  delete his_rd_p;
+  delete his_gc;
+}
+
 bool HisMaker::readTreeForChromosome(TString fileName,string chrom,
 				     short *arr_p,short *arr_u)
 {
+  RDFile rdf(RDFile::nameFor(fileName.Data()));
+  int rdc = findRDChromosome(rdf,chrom);
+  if (rdc >= 0) {
+    rdf.seek(rdc);
+    int position;
+    unsigned int cp,cu;
+    while (rdf.next(position,cp,cu)) {
+      if (arr_p) arr_p[position] += cp;
+      if (arr_u) arr_u[position] += cu;
+    }
+    return true;
+  }
+
   TFile file(fileName.Data());
   if (file.IsZombie()) {
     cerr<<"Can't open/read file '"<<fileName<<"'."<<endl;
@@ -3391,9 +4467,56 @@ bool HisMaker::readTreeForChromosome(TString fileName,string chrom,
   return true;
 }
 
+// Adds counts from tree to positions 1 .. len, as made by produceTrees()
+bool HisMaker::readTreeForChromosome(TString fileName,string chrom,
+				     SparseCounts *counts_p,
+				     SparseCounts *counts_u)
+{
+  RDFile rdf(RDFile::nameFor(fileName.Data()));
+  int rdc = findRDChromosome(rdf,chrom);
+  if (rdc >= 0) {
+    rdf.seek(rdc);
+    int position;
+    unsigned int cp,cu;
+    while (rdf.next(position,cp,cu)) {
+      if (counts_p) counts_p->add(position + 1,cp);
+      if (counts_u) counts_u->add(position + 1,cu);
+    }
+    return true;
+  }
+
+  TFile file(fileName.Data());
+  if (file.IsZombie()) {
+    cerr<<"Can't open/read file '"<<fileName<<"'."<<endl;
+    return false;
+  }
+  TTree *tree = (TTree*)file.Get(chrom.c_str());
+  if (!tree) tree = (TTree*)file.Get(Genome::makeCanonical(chrom).c_str());
+  if (!tree) {
+    cerr<<"Can't find tree for '"<<chrom<<"' in file '"
+	<<fileName<<"'."<<endl;
+    return false;
+  }
+    
+  int position;
+  short rd_unique,rd_parity;
+  tree->SetBranchAddress("position", &position);
+  tree->SetBranchAddress("rd_unique",&rd_unique);
+  tree->SetBranchAddress("rd_parity",&rd_parity);
+  int n_ent = tree->GetEntries();
+  for (int i = 0;i < n_ent;i++) {
+    tree->GetEntry(i);
+    if (counts_p) counts_p->add(position + 1,rd_parity);
+    if (counts_u) counts_u->add(position + 1,rd_unique);
+  }
+  file.Close();
+  return true;
+}
+
 void HisMaker::writeATTreeForChromosome(string chrom,int *arr,int n)
 {
   // Creating a tree
+  cache_.closeFile(root_file_name);
   TFile file(root_file_name.Data(),"Update");
   if (file.IsZombie()) {
     cerr<<"Can't open/write to file '"<<root_file_name<<"'."<<endl;
@@ -3467,6 +4590,12 @@ TString HisMaker::getPartitionName(TString chr,int bin,
   return ret;
 }
 
+TString HisMaker::getSegmentsName(TString chr,int bin,
+				  bool useATcorr,bool useGCcorr)
+{
+  return getPartitionName(chr,bin,useATcorr,useGCcorr) + "_segments";
+}
+
 TString HisMaker::getUSignalName(TString chrom,int bin)
 {
   TString ret = "his_rd_u_" + chrom + "_";
@@ -3481,11 +4610,48 @@ TString HisMaker::getGCName(TString chrom,int bin)
   return ret;
 }
 
+string HisMaker::sequenceFile(string chrom)
+{
+  if (fasta_) return fasta_->fileName();
+  return dir_ + "/" + chrom + ".fa";
+}
+
+int HisMaker::sequenceLength(string chrom)
+{
+  if (fasta_) {
+    int ci = fasta_->chromIndex(chrom);
+    return (ci < 0) ? -1 : fasta_->chromLen(ci) + 1;
+  }
+  // Sequence is not longer than its file
+  struct stat st;
+  if (::stat(sequenceFile(chrom).c_str(),&st) != 0) return -1;
+  return st.st_size + 1000;
+}
+
 int HisMaker::readChromosome(string chrom,char *seq,int max_len)
 {
   seq[0] = '\0';
 
   int ret = 0;
+  if (fasta_) {
+    int ci = fasta_->chromIndex(chrom);
+    if (ci < 0) {
+      cerr<<"Can't find '"<<chrom<<"' in file '"<<fasta_->fileName()<<"'."
+	  <<endl;
+      cerr<<"No chromosome/contig information parsed."<<endl;
+      return ret;
+    }
+    if (fasta_->chromLen(ci) > max_len)
+      cerr<<"Maximum buffer size exceeded."<<endl;
+    ret = fasta_->fetch(ci,seq,max_len);
+    if (ret < 0) {
+      cerr<<"Can't read '"<<chrom<<"' from file '"<<fasta_->fileName()<<"'."
+	  <<endl;
+      return 0;
+    }
+    if (ret < max_len) seq[ret] = '\0';
+    return ret;
+  }
   string chrom_file = dir_ + "/" + chrom + ".fa";
   ifstream file(chrom_file.c_str());
   if (!file.is_open()) {
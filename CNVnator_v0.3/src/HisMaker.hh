@@ -32,6 +32,18 @@ using namespace std;
 // Application includes
 #include "AliParser.hh"
 #include "Genome.hh"
+#include "ThreadPool.hh"
+#include "SparseCounts.hh"
+#include "RDFile.hh"
+#include "HisWriter.hh"
+#include "HisCache.hh"
+#include "SegmentStats.hh"
+#include "Segments.hh"
+#include "Metrics.hh"
+#include "GCIndex.hh"
+#include "GCAnnotation.hh"
+#include "Fasta.hh"
+#include "GCProfile.hh"
 
 // Constants
 const static TString chrAll = "all";
@@ -46,10 +58,13 @@ const static double GENOME_SIZE_CNV    = GENOME_SIZE*GENOME_CNV_FRACTION;
 const static double CUTOFF_REGION      = 0.05;
 const static double CUTOFF_TWO_REGIONS = 0.01;
 
+struct ChromosomeJobs;
+struct RegionJobs;
+
 class HisMaker
 {
 private:
-  static const int N_SQRT = 100000,N_FUNC = 100000,N_INV = 10000;
+  static const int N_SQRT = 100000,N_INV = 10000;
 
 private:
   int bin_size;           // Bin size
@@ -63,13 +78,23 @@ private:
   int chromosome_len;
   bool useMappability;
   double *sqrt_vals,*inv_vals;
-  TF1 **tfuncs;
   TH1 *gen_his_signal,*gen_his_distr,*gen_his_distr_all; // His for genotyping
   double _mean,    _sigma;     // Mean and sigma of gen_his_distr
   double _mean_all,_sigma_all; // Mean and sigma of gen_his_distr_all
   TCanvas *canv_view; // Canvas for displaying
   Genome *refGenome_;
   string dir_;
+  int n_threads_;
+  bool write_rd_; // Write counts per position in read depth file, not trees
+  bool adaptive_bands_; // Larger steps of bin band while mask is the same
+  double mask_tol_;     // Fraction of bins that can change for mask to be
+                        // counted as the same
+  HisWriter *writer_;   // Writer kept open on root_file_name during a step
+  int writer_depth_;    // Nesting of beginOutput()/endOutput()
+  HisCache cache_;      // Histograms read by getHistogram()
+  Metrics *metrics_;    // Timing and memory of steps, if requested
+  Fasta *fasta_;        // Indexed reference, used instead of dir_ if given
+  bool gc_qc_;          // Fill and write GC vs RD histograms in stat
 
 public:
   HisMaker(string rootFile,Genome *genome = NULL);
@@ -79,10 +104,18 @@ public:
 
   // Input/output
 private:
-  void writeTreeForChromosome(string chrom,short *arr_p,short *arr_u,int len);
+  void writeTreeForChromosome(string chrom,SparseCounts *counts_p,
+			      SparseCounts *counts_u,int len);
   bool readTreeForChromosome(TString fileName,
 			     string chrom,short *arr_p,short *arr_u);
+  bool readTreeForChromosome(TString fileName,string chrom,
+			     SparseCounts *counts_p,SparseCounts *counts_u);
   void writeATTreeForChromosome(string chrom,int *arr,int n);
+  void writeBinnedHistograms(string chrom,int len,int bin,
+			     int *arr_p,int *arr_u,
+			     int *gc_sum,int *at_sum,int step,
+			     bool useGCcorr = false,
+			     const signed char *gc_percent = NULL);
   bool writeHistograms(TH1 *his1 = NULL,TH1 *his2 = NULL,
 		       TH1 *his3 = NULL,TH1 *his4 = NULL,
 		       TH1 *his5 = NULL,TH1 *his6 = NULL)
@@ -103,6 +136,11 @@ public:
   TH1* getHistogram(TString name);
   TH1* getHistogram(TString name,TString rfile,TString dir);
 
+  // Between beginOutput() and endOutput() root file is kept open: written
+  // histograms are queued and read back through HisWriter
+  void beginOutput();
+  void endOutput();
+
   // Histogram naming
 private:
   TString rd_u_name,rd_u_xy_name;
@@ -113,27 +151,52 @@ private:
 
 public:
   void    setDataDir(string dir) { dir_ = dir; }
+  void    setNumThreads(int n) { n_threads_ = (n > 0) ? n : 1; }
+  void    setWriteRD(bool write) { write_rd_ = write; }
+  void    setAdaptiveBands(bool adaptive,double mask_tol = 0)
+  {
+    adaptive_bands_ = adaptive;
+    mask_tol_       = (mask_tol > 0) ? mask_tol : 0;
+  }
+  void    setMetrics(Metrics *metrics) { metrics_ = metrics; }
+  void    setFasta(Fasta *fasta) { fasta_ = fasta; }
+  void    setGCQC(bool qc) { gc_qc_ = qc; }
   TString getDirName(int bin);
   TString getDistrName(TString chr,int bin,bool useATcoor,bool useGCcorr);
   TString getRawSignalName(TString chr,int bin);
   TString getSignalName(TString chr,int bin,bool useATcoor,bool useGCcorr);
   TString getPartitionName(TString chr,int bin,bool useATcorr,bool useGCcorr);
+  TString getSegmentsName(TString chr,int bin,bool useATcorr,bool useGCcorr);
   TString getGCName(TString chrom,int bin);
   TString getUSignalName(TString chrom,int bin);
   TString getATaggrName() { return "his_at_aggr"; }
   int     readChromosome(string chrom,char *seq,int max_len);
+  // File with sequence of chromosome and upper bound of its length (-1 if
+  // there is no sequence)
+  string  sequenceFile(string chrom);
+  int     sequenceLength(string chrom);
+  // Prefix sums of GC and AT over chunks of step bases (see sumGCandAT())
+  // from cached index or from sequence read into seq; false if sequence
+  // is not of length len
+  bool    readGCandAT(string chrom,int len,int step,char *seq,
+		      int *gc_sum,int *at_sum);
+  // GC percentage per bin for each of bin sizes from reference annotation;
+  // false if chromosome of length len is not annotated for all of them
+  bool    readGCAnnotation(GCAnnotation *annotation,string chrom,int len,
+			   int *bins,int n_bins,const signed char **gc);
   int     parseGCandAT(char *seq,int len,int **address,TH1 *his = NULL);
 
   // Making trees, histograms, parititoning, PE support
 public:
   void produceTrees(string *user_chroms,int n_chroms,
 		    string *user_files,int n_files,
-		    bool forUnique);
+		    bool forUnique,int *bins = NULL,int n_bins = 0);
   void mergeTrees(string *user_chroms,int n_chroms,
 		  string *user_files,int n_files);
+  void prepareReference(string *user_chroms,int n_chroms,int *bins,int n_bins);
   void produceHistograms(string *chrom,int n_chroms,
 			 string *root_files,int n_root_files,
-			 bool useGCcorr = false);
+			 bool useGCcorr = false,int *bins = NULL,int n_bins = 0);
   void produceHistograms_try_correct(string *user_chroms,int n_chroms);
   void produceHistogramsNew(string *user_chroms,int n_chroms);
   void aggregate(string *files,int n_files,string *chrom,int n_chroms);
@@ -154,17 +217,39 @@ private:
 		  bool do_print = true,int *ses = NULL);
 
 
+  // Per-chromosome work run on thread pool (see ChromosomeJobs)
+private:
+  static void histogramsJob(int job,int thread,void *arg);
+  static void prepareReferenceJob(int job,int thread,void *arg);
+  static void correctATJob(int job,int thread,void *arg);
+  static void partitionJob(int job,int thread,void *arg);
+  static void callSVsJob(int job,int thread,void *arg);
+  void histogramsChromosome(ChromosomeJobs *jobs,int job,int thread);
+  void prepareReferenceChromosome(ChromosomeJobs *jobs,int job,int thread);
+  void correctATChromosome(ChromosomeJobs *jobs,int job,int thread);
+  void partitionChromosome(ChromosomeJobs *jobs,int job,int thread);
+  void callSVsChromosome(ChromosomeJobs *jobs,int job,int thread);
+
+  // Refining and evaluating regions of one chromosome (see RegionJobs)
+private:
+  static void refineRegionsJob(int job,int thread,void *arg);
+  static void evaluateRegionsJob(int job,int thread,void *arg);
+  void runRegionJobs(ThreadPool::Task task,RegionJobs *regions,int n_threads);
+
 private:
-  bool correctGC(TH1 *his,TH1 *his_gc,TH2* his_rd_gc,TH1 *his_mean);
-  bool correctGCbyFragment(TH1 *his,TH1 *his_gc,TH2* his_rd_gc,TH1 *his_mean);
-  void calcGCcorrection(TH2* his_rd_gc,TH1 *his_mean,double *corr,int n);
-  void updateMask(double *rd,double *level,bool *mask,int n_bins,
+  // Multiplies RD by factors from GCProfile::correction() for GC of bins
+  bool correctGC(TH1 *his,TH1 *his_gc,GCProfile &profile,
+		 const double *gc_corr);
+  bool correctGCbyFragment(TH1 *his,TH1 *his_gc,GCProfile &profile,
+			   TH1 *his_mean);
+  void updateMask(SegmentStats &rd,double *level,bool *mask,int n_bins,
 		   double mean,double sigma);
-  void updateMask_skip(double *rd,double *level,bool *mask,int n_bins,
+  void updateMask_skip(SegmentStats &rd,double *level,bool *mask,int n_bins,
 		       double mean,double sigma);
   void calcLevels(double *level,bool *mask,int n_bins,int bin_band,
-		  double mean,double sigma,bool skipMasked);
-  bool mergeLevels(double *level,int n_bins,double delta);
+		  double mean,double sigma,bool skipMasked,int n_threads = 1);
+  bool mergeLevels(double *level,int n_bins,double delta,Segments &segments);
+  int  nextBinBand(int bin_band);
 
 public: // Viewing and genotyping
   void view(string *files,int n_files,bool useATcorr,bool useGCcorr);
@@ -184,21 +269,22 @@ private:
 private:
   double getInverse(int n);
   double getSqrt(int n);
-  TF1 *getTFunction(int n);
-  void getAverageVariance(double *rd,int start,int stop,
+  double tCDF(double x,int n);
+  void getAverageVariance(SegmentStats &rd,int start,int stop,
 			  double &average,double &variance,int &n);
   double testRegion(double value,double m,double s,int n);
   double testTwoRegions(double m1,double s1,int n1,double m2,double s2,int n2,
 			double scale);
-  double getEValue(double mean,double sigma,double *rd,int start,int end);
+  double getEValue(double mean,double sigma,SegmentStats &rd,
+		   int start,int end);
   bool sameLevel(double l1, double l2);
   bool getRegionLeft(double *level,int n_bins,int bin,int &start,int &stop);
-  bool getRegionRight(double *level,int n_bins,int bin,int &start,int &stop);
   double getMean(TH1 *his);
-  bool adjustToEValue(double mean,double sigma,double *rd,int n_bins,
+  bool adjustToEValue(double mean,double sigma,SegmentStats &rd,int n_bins,
 		      int &start,int &end,double eval);
   int countGCpercentage(char *seq,int low,int up);
-  double gaussianEValue(double mean,double sigma,double *rd,int start,int end);
+  double gaussianEValue(double mean,double sigma,SegmentStats &rd,
+			int start,int end);
   int getChromNamesWithHis(string *names,bool useATcorr,bool useGCcorr);
   int getChromNamesWithTree(string *names,string rfn = "");
   int getChromLenWithTree(string name,string rfn = "");
@@ -0,0 +1,111 @@
+// Application includes
+#include "HisWriter.hh"
+
+HisWriter::HisWriter(TString fileName) : file_name_(fileName),
+					 file_(NULL),
+					 n_queued_(0)
+{
+  pthread_mutex_init(&lock_,NULL);
+  file_ = new TFile(file_name_,"Update");
+  if (file_->IsZombie()) {
+    cerr<<"Can't open/write to file '"<<file_name_<<"'."<<endl;
+    delete file_;
+    file_ = NULL;
+  }
+  gROOT->cd();
+}
+
+HisWriter::~HisWriter()
+{
+  close();
+  pthread_mutex_destroy(&lock_);
+}
+
+bool HisWriter::add(TString dir,TH1 *his)
+{
+  if (!his) return true;
+  pthread_mutex_lock(&lock_);
+  bool ret = file_ != NULL;
+  if (ret) {
+    Entry e;
+    e.dir = dir;
+    e.his = (TH1*)his->Clone(his->GetName());
+    e.his->SetDirectory(0);
+    queue_.push_back(e);
+    n_queued_ += (long)(his->GetNbinsX() + 2)*(his->GetNbinsY() + 2)*
+      (his->GetNbinsZ() + 2);
+    if (n_queued_ >= MAX_QUEUED) ret = writeQueue();
+  }
+  pthread_mutex_unlock(&lock_);
+  return ret;
+}
+
+bool HisWriter::flush()
+{
+  pthread_mutex_lock(&lock_);
+  bool ret = writeQueue();
+  pthread_mutex_unlock(&lock_);
+  return ret;
+}
+
+TH1 *HisWriter::get(TString dir,TString name)
+{
+  pthread_mutex_lock(&lock_);
+  TH1 *ret = NULL;
+  if (writeQueue()) {
+    TDirectory *d = getDirectory(dir,false);
+    TH1 *his = d ? (TH1*)d->Get(name) : NULL;
+    gROOT->cd();
+    if (his) {
+      ret = (TH1*)his->Clone(name);
+      delete his; // Keeping only directories in memory of the file
+    }
+  }
+  pthread_mutex_unlock(&lock_);
+  return ret;
+}
+
+void HisWriter::close()
+{
+  pthread_mutex_lock(&lock_);
+  writeQueue();
+  if (file_) {
+    file_->Write();
+    file_->Close();
+    delete file_;
+    file_ = NULL;
+  }
+  gROOT->cd();
+  pthread_mutex_unlock(&lock_);
+}
+
+TDirectory *HisWriter::getDirectory(TString dir,bool create)
+{
+  if (dir.Length() == 0) return file_;
+  TDirectory *ret = file_->GetDirectory(dir);
+  if (!ret && create) {
+    cout<<"Making directory "<<dir<<" ..."<<endl;
+    ret = file_->mkdir(dir);
+    if (!ret) cerr<<"Can't find/create directory '"<<dir<<"'."<<endl;
+  }
+  return ret;
+}
+
+// Called with lock held
+bool HisWriter::writeQueue()
+{
+  bool ret = file_ != NULL;
+  for (unsigned int i = 0;i < queue_.size();i++) {
+    Entry &e = queue_[i];
+    TDirectory *dir = ret ? getDirectory(e.dir,true) : NULL;
+    if (dir) {
+      dir->cd();
+      e.his->Write(e.his->GetName(),TObject::kOverwrite);
+    } else ret = false;
+    delete e.his;
+  }
+  queue_.clear();
+  n_queued_ = 0;
+  gROOT->cd();
+  return ret;
+}
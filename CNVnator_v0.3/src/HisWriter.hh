@@ -0,0 +1,60 @@
+#ifndef __HISWRITER_HH__
+#define __HISWRITER_HH__
+
+// C/C++ includes
+#include <pthread.h>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+// ROOT includes
+#include <TROOT.h>
+#include <TFile.h>
+#include <TH1.h>
+
+// Writes histograms into root file, which is kept open for as long as the
+// writer exists (e.g., for one step such as -his or -partition). Copies of
+// histograms are queued, from any thread, and written in batches; keys and
+// free segments of the file are written once, when the writer is closed.
+// Histograms can be read back through the writer while it is open.
+class HisWriter
+{
+private:
+  static const long MAX_QUEUED = 1<<24; // Bins held in queue before writing
+
+  struct Entry
+  {
+    TString dir;
+    TH1    *his;
+  };
+
+  TString         file_name_;
+  TFile          *file_;
+  vector<Entry>   queue_;
+  long            n_queued_;
+  pthread_mutex_t lock_;
+
+public:
+  HisWriter(TString fileName);
+  ~HisWriter();
+
+  inline bool    isOpen()   { return file_ != NULL; }
+  inline TString fileName() { return file_name_; }
+
+  // Queues copy of histogram to be written into directory dir ("" for top)
+  bool add(TString dir,TH1 *his);
+
+  // Writes queued histograms
+  bool flush();
+
+  // Copy of histogram from file, queued ones included; NULL if not found
+  TH1 *get(TString dir,TString name);
+
+  void close();
+
+private:
+  TDirectory *getDirectory(TString dir,bool create);
+  bool        writeQueue();
+};
+
+#endif
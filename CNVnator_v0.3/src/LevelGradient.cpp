@@ -0,0 +1,129 @@
+// C/C++ includes
+#include <cmath>
+
+// Application includes
+#include "LevelGradient.hh"
+#include "FastMath.hh"
+#include "ThreadPool.hh"
+
+static inline double libmExp(double x) { return exp(x); }
+
+// Gradient for unmasked bins first .. last - 1 out of n, given by their
+// levels lev and inverse variances inv. Kernel ker has 2*win + 1 weights,
+// negative for neighbours on the left; terms is buffer of the same size.
+// Terms are computed in a branch free (vectorized) loop and summed in
+// order of bins, as pairwise loop did.
+template<double (*EXP)(double)>
+static void gradientRange(const double *lev,const double *inv,int n,
+			  const double *ker,int win,double *terms,
+			  double *grad,int first,int last)
+{
+  for (int j = first;j < last;j++) {
+    int s = j - win,e = j + win + 1;
+    if (s < 0) s = 0;
+    if (e > n) e = n;
+    const double lj = lev[j],ij = inv[j];
+    const double *lk = lev + s,*wk = ker + win - j + s;
+    int len = e - s;
+    for (int k = 0;k < len;k++) {
+      double r = lk[k] - lj;
+      terms[k] = wk[k]*EXP(-0.5*r*r*ij);
+    }
+    double g = 0;
+    for (int k = 0;k < j - s;k++)       g += terms[k];
+    for (int k = j - s + 1;k < len;k++) g += terms[k];
+    grad[j] = g;
+  }
+}
+
+static void gradientRange(bool fast,const double *lev,const double *inv,
+			  int n,const double *ker,int win,double *terms,
+			  double *grad,int first,int last)
+{
+  if (fast)
+    gradientRange<fastExp>(lev,inv,n,ker,win,terms,grad,first,last);
+  else
+    gradientRange<libmExp>(lev,inv,n,ker,win,terms,grad,first,last);
+}
+
+// Fewer unmasked bins per thread are not worth starting threads for
+static const int MIN_LEVEL_TILE = 4096;
+
+// Data shared by threads calculating gradient of levels. Each job does a
+// tile of bins reading win bins on each side of it, and writes gradient
+// for its bins only, so result does not depend on number of threads.
+struct LevelTiles
+{
+  double  *lev,*inv,*ker,*grad;
+  double **terms; // Per thread
+  int      n,win,tile;
+  bool     fast;
+};
+
+static void levelTileJob(int job,int thread,void *arg)
+{
+  LevelTiles *tiles = (LevelTiles*)arg;
+  int first = job*tiles->tile,last = first + tiles->tile;
+  if (last > tiles->n) last = tiles->n;
+  gradientRange(tiles->fast,tiles->lev,tiles->inv,tiles->n,tiles->ker,
+		tiles->win,tiles->terms[thread],tiles->grad,first,last);
+}
+
+void levelGradient(const double *level,const bool *mask,int n_bins,
+		   int bin_band,double mean,double sigma,double *grad_b,
+		   int n_threads,bool fast)
+{
+  for (int b = 0;b < n_bins;b++) grad_b[b] = 0;
+
+  double inv2_bin_band = 1./(bin_band*bin_band);
+  double mean_4 = mean/4, sigma_2 = 4/(sigma*sigma),ms2 = mean/(sigma*sigma);
+  int    win = 3*bin_band;
+  double *ker = new double[2*win + 1];
+  for (int i = 0;i <= win;i++) {
+    ker[win + i] = i*exp(-0.5*i*i*inv2_bin_band);
+    ker[win - i] = -ker[win + i];
+  }
+
+  // Compacting unmasked bins, window spans win of them on each side
+  int    *index = new int[n_bins],n = 0;
+  double *lev   = new double[n_bins];
+  double *inv   = new double[n_bins];
+  double *grad  = new double[n_bins];
+  for (int b = 0;b < n_bins;b++) {
+    if (mask[b]) continue;
+    index[n] = b;
+    lev[n]   = level[b];
+    if (level[b] < mean_4) inv[n] = sigma_2;
+    else                   inv[n] = ms2/level[b];
+    n++;
+  }
+  if (n_threads > 1 && n >= 2*MIN_LEVEL_TILE) {
+    ThreadPool pool(n_threads);
+    LevelTiles tiles;
+    tiles.lev  = lev;
+    tiles.inv  = inv;
+    tiles.ker  = ker;
+    tiles.grad = grad;
+    tiles.n    = n;
+    tiles.win  = win;
+    tiles.fast = fast;
+    tiles.tile = (n + n_threads - 1)/n_threads;
+    if (tiles.tile < MIN_LEVEL_TILE) tiles.tile = MIN_LEVEL_TILE;
+    n_threads   = pool.numThreads();
+    tiles.terms = new double*[n_threads];
+    for (int t = 0;t < n_threads;t++) tiles.terms[t] = new double[2*win + 1];
+    pool.run(levelTileJob,&tiles,(n + tiles.tile - 1)/tiles.tile);
+    for (int t = 0;t < n_threads;t++) delete[] tiles.terms[t];
+    delete[] tiles.terms;
+  } else {
+    double *terms = new double[2*win + 1];
+    gradientRange(fast,lev,inv,n,ker,win,terms,grad,0,n);
+    delete[] terms;
+  }
+  for (int i = 0;i < n;i++) grad_b[index[i]] = grad[i];
+  delete[] ker;
+  delete[] index;
+  delete[] lev;
+  delete[] inv;
+  delete[] grad;
+}
@@ -0,0 +1,26 @@
+#ifndef __LEVELGRADIENT_HH__
+#define __LEVELGRADIENT_HH__
+
+// Exponent used in gradient of levels by default. Fast exponent pays off
+// when loop is vectorized with AVX2 (make OPTFLAGS="-O3 -mavx2 -mfma");
+// gradient then differs in last digits only. Otherwise, or with
+// -DCNVNATOR_LIBM_EXP, gradient is the same, bit by bit, as pairwise loop
+// over bins gave.
+#if defined(__AVX2__) && !defined(CNVNATOR_LIBM_EXP)
+#define LEVEL_FAST_EXP true
+#else
+#define LEVEL_FAST_EXP false
+#endif
+
+// Mean-shift gradient of RD levels, as used in partitioning (see
+// HisMaker::calcLevels()), into grad[0 .. n_bins). Each unmasked bin sums
+// over up to 3*bin_band unmasked bins on each side kernel weight times
+// Gaussian of level difference with variance for level of the bin; masked
+// bins get 0. With more than one thread, bins are split into tiles; result
+// does not depend on number of threads. With fast, exponent is fastExp()
+// (FastMath.hh), libm exp otherwise.
+void levelGradient(const double *level,const bool *mask,int n_bins,
+		   int bin_band,double mean,double sigma,double *grad,
+		   int n_threads = 1,bool fast = LEVEL_FAST_EXP);
+
+#endif
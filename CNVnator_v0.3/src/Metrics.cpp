@@ -0,0 +1,148 @@
+// C/C++ includes
+#include <time.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// Application includes
+#include "Metrics.hh"
+
+Metrics::Metrics(string fileName) : file_name_(fileName)
+{
+  pthread_mutex_init(&lock_,NULL);
+}
+
+Metrics::~Metrics()
+{
+  pthread_mutex_destroy(&lock_);
+}
+
+Metrics::Mark Metrics::mark(bool chromosome)
+{
+  Mark m;
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  m.wall = ts.tv_sec + 1e-9*ts.tv_nsec;
+  clock_gettime(chromosome ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID,
+		&ts);
+  m.cpu  = ts.tv_sec + 1e-9*ts.tv_nsec;
+  m.process = !chromosome;
+  m.read = m.written = -1;
+  if (m.process) ioCounters(m.read,m.written);
+  return m;
+}
+
+void Metrics::record(string step,string phase,string chrom,
+		     const Mark &start,long items)
+{
+  Mark end = mark(!start.process);
+  Record r;
+  r.step  = step;
+  r.phase = phase;
+  r.chrom = chrom;
+  r.wall  = end.wall - start.wall;
+  r.cpu   = end.cpu  - start.cpu;
+  r.items = items;
+  r.read = r.written = -1;
+  if (start.process && start.read >= 0 && end.read >= 0) {
+    r.read    = end.read    - start.read;
+    r.written = end.written - start.written;
+  }
+  add(r);
+}
+
+void Metrics::record(string step,string phase,string chrom,
+		     double wall,double cpu,long items)
+{
+  Record r;
+  r.step  = step;
+  r.phase = phase;
+  r.chrom = chrom;
+  r.wall  = wall;
+  r.cpu   = cpu;
+  r.items = items;
+  r.read = r.written = -1;
+  add(r);
+}
+
+void Metrics::add(Record &r)
+{
+  r.rss_kb = peakRSS();
+  pthread_mutex_lock(&lock_);
+  records_.push_back(r);
+  pthread_mutex_unlock(&lock_);
+}
+
+bool Metrics::write()
+{
+  pthread_mutex_lock(&lock_);
+  bool header = true;
+  ifstream in(file_name_.c_str());
+  if (in.is_open()) header = in.peek() == ifstream::traits_type::eof();
+  in.close();
+  ofstream out(file_name_.c_str(),ios::app);
+  if (!out.is_open()) {
+    cerr<<"Can't open file '"<<file_name_<<"' to write metrics."<<endl;
+    pthread_mutex_unlock(&lock_);
+    return false;
+  }
+  if (header)
+    out<<"step\tphase\tchrom\twall_s\tcpu_s\tpeak_rss_kb\titems"
+       <<"\tbytes_read\tbytes_written"<<endl;
+  for (unsigned int i = 0;i < records_.size();i++) {
+    Record &r = records_[i];
+    char times[64];
+    snprintf(times,64,"%.3f\t%.3f",r.wall,r.cpu);
+    out<<r.step<<"\t"<<r.phase<<"\t"<<(r.chrom == "" ? "all" : r.chrom)<<"\t"
+       <<times<<"\t"<<r.rss_kb<<"\t";
+    if (r.items >= 0) out<<r.items; else out<<"NA";
+    out<<"\t";
+    if (r.read >= 0) out<<r.read<<"\t"<<r.written;
+    else             out<<"NA\tNA";
+    out<<endl;
+  }
+  records_.clear();
+  bool ret = out.good();
+  pthread_mutex_unlock(&lock_);
+  return ret;
+}
+
+double Metrics::wallTime(string step,string phase,string chrom)
+{
+  double ret = -1;
+  pthread_mutex_lock(&lock_);
+  for (unsigned int i = 0;i < records_.size();i++) {
+    Record &r = records_[i];
+    if (r.step != step || r.phase != phase || r.chrom != chrom) continue;
+    ret = (ret < 0) ? r.wall : ret + r.wall;
+  }
+  pthread_mutex_unlock(&lock_);
+  return ret;
+}
+
+void Metrics::clear()
+{
+  pthread_mutex_lock(&lock_);
+  records_.clear();
+  pthread_mutex_unlock(&lock_);
+}
+
+long Metrics::peakRSS()
+{
+  rusage ru;
+  if (getrusage(RUSAGE_SELF,&ru) != 0) return -1;
+  return ru.ru_maxrss; // In kB on Linux
+}
+
+void Metrics::ioCounters(long &read,long &written)
+{
+  // Bytes passed through read/write calls, including page cache hits
+  read = written = -1;
+  ifstream in("/proc/self/io");
+  string key;
+  long val;
+  while (in>>key>>val) {
+    if      (key == "rchar:") read    = val;
+    else if (key == "wchar:") written = val;
+  }
+}
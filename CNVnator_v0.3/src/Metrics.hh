@@ -0,0 +1,74 @@
+#ifndef __METRICS_HH__
+#define __METRICS_HH__
+
+// C/C++ includes
+#include <pthread.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Collects wall and CPU time, peak memory, number of items (reads, bins,
+// calls) and bytes read/written for phases of a step, overall and per
+// chromosome. Records can be added from any thread and are written as
+// tab-separated lines, appended to the file, so several runs on the same
+// root file end up in one table.
+class Metrics
+{
+public:
+  // Clocks and I/O counters at some point. CPU time is of whole process for
+  // step-wide records and of calling thread for per-chromosome ones; bytes
+  // are counted only for process, since threads share I/O.
+  struct Mark
+  {
+    double wall,cpu;
+    long   read,written;
+    bool   process;
+  };
+
+private:
+  struct Record
+  {
+    string step,phase,chrom;
+    double wall,cpu;
+    long   rss_kb,items,read,written;
+  };
+
+  string          file_name_;
+  vector<Record>  records_;
+  pthread_mutex_t lock_;
+
+public:
+  Metrics(string fileName);
+  ~Metrics();
+
+  inline string fileName() { return file_name_; }
+
+  // Clocks now; chromosome tells to take CPU time of calling thread
+  static Mark mark(bool chromosome = false);
+
+  // Records phase started at mark start and ending now; empty chrom is for
+  // whole step
+  void record(string step,string phase,string chrom,
+	      const Mark &start,long items = -1);
+
+  // Records phase with time already summed up (e.g., over bin bands)
+  void record(string step,string phase,string chrom,
+	      double wall,double cpu,long items = -1);
+
+  // Appends records to file
+  bool write();
+
+  // Wall time summed over records of phase not yet written, -1 if there
+  // are none; e.g., for reporting phases without writing file
+  double wallTime(string step,string phase,string chrom);
+  void   clear();
+
+private:
+  static long peakRSS();
+  static void ioCounters(long &read,long &written);
+  void add(Record &r);
+};
+
+#endif
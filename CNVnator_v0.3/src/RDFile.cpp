@@ -0,0 +1,287 @@
+// C/C++ includes
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Application includes
+#include "RDFile.hh"
+#include "AtomicFile.hh"
+
+static const char MAGIC[] = "CNVRD001";
+static const int  HEADER  = 16;
+
+static inline unsigned int getVarint(const unsigned char *&p)
+{
+  unsigned int ret = 0;
+  int shift = 0;
+  unsigned char c;
+  do {
+    c = *p++;
+    ret |= (unsigned int)(c & 0x7f)<<shift;
+    shift += 7;
+  } while (c & 0x80);
+  return ret;
+}
+
+static inline void putVarint(vector<unsigned char> &v,unsigned int val)
+{
+  while (val >= 0x80) {
+    v.push_back((val & 0x7f) | 0x80);
+    val >>= 7;
+  }
+  v.push_back(val);
+}
+
+RDFile::RDFile(string fileName) : fd_(-1),
+				  data_(NULL),
+				  size_(0),
+				  index_(0),
+				  chr_(-1),
+				  block_(0),
+				  left_(0),
+				  pos_(0),
+				  col_pos_(NULL),
+				  col_p_(NULL),
+				  col_u_(NULL)
+{
+  fd_ = open(fileName.c_str(),O_RDONLY);
+  if (fd_ < 0) return;
+  struct stat st;
+  if (fstat(fd_,&st) == 0 && st.st_size >= HEADER) {
+    size_ = st.st_size;
+    void *addr = mmap(NULL,size_,PROT_READ,MAP_SHARED,fd_,0);
+    if (addr != MAP_FAILED) data_ = (const unsigned char*)addr;
+  }
+  if (data_ && !readIndex()) {
+    cerr<<"File '"<<fileName<<"' is not a valid read depth file."<<endl;
+    munmap((void*)data_,size_);
+    data_ = NULL;
+    chroms_.clear();
+  }
+}
+
+RDFile::~RDFile()
+{
+  if (data_)   munmap((void*)data_,size_);
+  if (fd_ >= 0) close(fd_);
+}
+
+bool RDFile::readIndex()
+{
+  if (memcmp(data_,MAGIC,8) != 0) return false;
+  memcpy(&index_,data_ + 8,sizeof(index_));
+  if (index_ < HEADER || index_ + 4 > size_) return false;
+  const unsigned char *p = data_ + index_,*end = data_ + size_;
+  unsigned int n_chroms,len,n_blocks;
+  memcpy(&n_chroms,p,4); p += 4;
+  chroms_.resize(n_chroms);
+  for (unsigned int c = 0;c < n_chroms;c++) {
+    Chrom &ch = chroms_[c];
+    if (p + 4 > end) return false;
+    memcpy(&len,p,4); p += 4;
+    if (p + len + 8 > end) return false;
+    ch.name.assign((const char*)p,len); p += len;
+    memcpy(&ch.len,p,4); p += 4;
+    memcpy(&n_blocks,p,4); p += 4;
+    if (p + n_blocks*20 > end) return false;
+    ch.blocks.resize(n_blocks);
+    for (unsigned int b = 0;b < n_blocks;b++) {
+      Block &bl = ch.blocks[b];
+      memcpy(&bl.first, p,4); p += 4;
+      memcpy(&bl.n,     p,4); p += 4;
+      memcpy(&bl.offset,p,8); p += 8;
+      memcpy(&bl.size,  p,4); p += 4;
+      if (bl.offset < HEADER || bl.offset + bl.size > index_) return false;
+    }
+  }
+  return true;
+}
+
+int RDFile::chromIndex(string name)
+{
+  for (int i = 0;i < numChrom();i++)
+    if (chroms_[i].name == name) return i;
+  return -1;
+}
+
+string RDFile::nameFor(string rootFile)
+{
+  int len = rootFile.length();
+  if (len > 5 && rootFile.substr(len - 5,5) == ".root")
+    return rootFile.substr(0,len - 5) + ".rd";
+  return rootFile + ".rd";
+}
+
+void RDFile::openBlock(int b)
+{
+  const Block &bl = chroms_[chr_].blocks[b];
+  const unsigned char *p = data_ + bl.offset;
+  unsigned int size_pos,size_p;
+  memcpy(&size_pos,p,4);
+  memcpy(&size_p,p + 4,4);
+  col_pos_ = p + 8;
+  col_p_   = col_pos_ + size_pos;
+  col_u_   = col_p_ + size_p;
+  block_   = b;
+  left_    = bl.n;
+  pos_     = bl.first;
+}
+
+bool RDFile::seek(int chr,int pos)
+{
+  left_ = 0;
+  if (!data_ || chr < 0 || chr >= numChrom()) return false;
+  chr_ = chr;
+  const vector<Block> &blocks = chroms_[chr].blocks;
+  if (blocks.size() == 0) return true;
+  // Last block starting at or before pos
+  int low = 0,up = blocks.size() - 1;
+  while (low < up) {
+    int mid = (low + up + 1)>>1;
+    if (blocks[mid].first <= pos) low = mid;
+    else                          up  = mid - 1;
+  }
+  openBlock(low);
+  // Skipping positions before pos
+  while (left_ > 0) {
+    const unsigned char *p = col_pos_;
+    int next = pos_ + getVarint(p);
+    if (next >= pos) break;
+    col_pos_ = p;
+    pos_     = next;
+    getVarint(col_p_);
+    getVarint(col_u_);
+    left_--;
+  }
+  return true;
+}
+
+bool RDFile::next(int &pos,unsigned int &count_p,unsigned int &count_u)
+{
+  if (left_ == 0) {
+    if (chr_ < 0 || block_ + 1 >= (int)chroms_[chr_].blocks.size())
+      return false;
+    openBlock(block_ + 1);
+  }
+  pos_ += getVarint(col_pos_);
+  count_p = getVarint(col_p_);
+  count_u = getVarint(col_u_);
+  left_--;
+  pos = pos_;
+  return true;
+}
+
+bool RDFile::writeBlock(FILE *f,vector<unsigned char> *cols,
+			vector<Block> &blocks,int first,int n)
+{
+  if (n == 0) return true;
+  Block bl;
+  bl.first  = first;
+  bl.n      = n;
+  bl.offset = ftello(f);
+  unsigned int sizes[2] = {(unsigned int)cols[0].size(),
+			   (unsigned int)cols[1].size()};
+  bl.size   = 8 + cols[0].size() + cols[1].size() + cols[2].size();
+  if (fwrite(sizes,4,2,f) != 2) return false;
+  for (int i = 0;i < 3;i++) {
+    if (fwrite(&cols[i][0],1,cols[i].size(),f) != cols[i].size()) return false;
+    cols[i].clear();
+  }
+  blocks.push_back(bl);
+  return true;
+}
+
+bool RDFile::write(string fileName,string chrom,int len,
+		   SparseCounts *counts_p,SparseCounts *counts_u)
+{
+  // Data in file are never overwritten: new blocks and index are appended
+  // and made durable before the header points to the new index, so runs
+  // reading the file, or an interrupted write, see the old index. Once
+  // replaced blocks and old indexes take more than live blocks, the file
+  // is written anew under temporary name, with other chromosomes copied,
+  // and renamed.
+  RDFile old(fileName);
+  vector<Chrom> chroms;
+  long long live = 0;
+  for (int i = 0;i < old.numChrom();i++) {
+    if (old.chroms_[i].name == chrom) continue;
+    chroms.push_back(old.chroms_[i]);
+    for (unsigned int b = 0;b < old.chroms_[i].blocks.size();b++)
+      live += old.chroms_[i].blocks[b].size;
+  }
+  bool append = old.isOpen() && old.size_ - HEADER - live <= live;
+
+  AtomicFile *out = append ? NULL : new AtomicFile(fileName);
+  FILE *f = append ? fopen(fileName.c_str(),"r+b") : out->file();
+  if (!f) {
+    cerr<<"Can't open/write to file '"
+	<<(append ? fileName : out->tmpName())<<"'."<<endl;
+    delete out;
+    return false;
+  }
+  bool ok = true;
+  if (append) ok = fseeko(f,old.size_,SEEK_SET) == 0;
+  else {
+    long long zero = 0;
+    ok = fwrite(MAGIC,1,8,f) == 8 && fwrite(&zero,8,1,f) == 1;
+    for (unsigned int c = 0;ok && c < chroms.size();c++)
+      for (unsigned int b = 0;ok && b < chroms[c].blocks.size();b++) {
+	Block &bl = chroms[c].blocks[b];
+	const unsigned char *data = old.data_ + bl.offset;
+	bl.offset = ftello(f);
+	ok = fwrite(data,1,bl.size,f) == bl.size;
+      }
+  }
+
+  Chrom ch;
+  ch.name = chrom;
+  ch.len  = len;
+  vector<unsigned char> cols[3];
+  SparseCountsPair counts(counts_p,counts_u);
+  int pos,first = 0,prev = 0,n = 0;
+  unsigned int cp,cu;
+  while (ok && counts.next(pos,cp,cu)) {
+    if (pos < 1 || pos > len) continue;
+    pos--;
+    if (n == 0) first = prev = pos;
+    putVarint(cols[0],pos - prev);
+    putVarint(cols[1],cp);
+    putVarint(cols[2],cu);
+    prev = pos;
+    if (++n == BLOCK) {
+      ok = writeBlock(f,cols,ch.blocks,first,n);
+      n = 0;
+    }
+  }
+  if (ok) ok = writeBlock(f,cols,ch.blocks,first,n);
+  chroms.push_back(ch);
+
+  // Writing index, and its offset in header once index is on disk
+  long long index = ftello(f);
+  unsigned int n_chroms = chroms.size();
+  ok = ok && fwrite(&n_chroms,4,1,f) == 1;
+  for (unsigned int c = 0;ok && c < n_chroms;c++) {
+    Chrom &chr = chroms[c];
+    unsigned int name_len = chr.name.length(),n_blocks = chr.blocks.size();
+    ok = fwrite(&name_len,4,1,f) == 1 &&
+      fwrite(chr.name.c_str(),1,name_len,f) == name_len &&
+      fwrite(&chr.len,4,1,f) == 1 && fwrite(&n_blocks,4,1,f) == 1;
+    for (unsigned int b = 0;ok && b < n_blocks;b++) {
+      Block &bl = chr.blocks[b];
+      ok = fwrite(&bl.first,4,1,f) == 1 && fwrite(&bl.n,4,1,f) == 1 &&
+	fwrite(&bl.offset,8,1,f) == 1 && fwrite(&bl.size,4,1,f) == 1;
+    }
+  }
+  if (append) ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+  ok = ok && fseeko(f,8,SEEK_SET) == 0 && fwrite(&index,8,1,f) == 1;
+  ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+  if (append) ok = fclose(f) == 0 && ok;
+  else        ok = out->commit(ok);
+  delete out;
+  if (!ok) cerr<<"Can't write to file '"<<fileName<<"'."<<endl;
+  return ok;
+}
@@ -0,0 +1,82 @@
+#ifndef __RDFILE_HH__
+#define __RDFILE_HH__
+
+// C/C++ includes
+#include <cstdio>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Application includes
+#include "SparseCounts.hh"
+
+// Read depth per position for chromosomes of one sample, stored in columns
+// and read through mmap. Same data as trees made by -tree: positions are
+// 0-based, counts are for all and for unique reads. File layout:
+//
+//   header: magic "CNVRD001", uint64 offset of index
+//   blocks: at most BLOCK entries each; uint32 sizes of first two columns,
+//           then columns of varints: position deltas, counts, unique counts
+//   index:  uint32 number of chromosomes, then per chromosome uint32 name
+//           length, name, int32 length, uint32 number of blocks and per
+//           block int32 first position, uint32 entries, uint64 offset,
+//           uint32 size
+class RDFile
+{
+private:
+  static const int BLOCK = 65536;
+
+  struct Block
+  {
+    int          first,n;
+    long long    offset;
+    unsigned int size;
+  };
+
+  struct Chrom
+  {
+    string        name;
+    int           len;
+    vector<Block> blocks;
+  };
+
+  int                  fd_;
+  const unsigned char *data_;
+  long long            size_,index_;
+  vector<Chrom>        chroms_;
+
+public:
+  RDFile(string fileName);
+  ~RDFile();
+
+  inline bool   isOpen()   { return data_ != NULL; }
+  inline int    numChrom() { return chroms_.size(); }
+  inline string chromName(int i) { return chroms_[i].name; }
+  inline int    chromLen(int i)  { return chroms_[i].len; }
+  int           chromIndex(string name);
+
+  // Name of file going along with root file
+  static string nameFor(string rootFile);
+
+  // Adds (or replaces) chromosome with counts at positions 1 .. len
+  // of counts_p and counts_u, which become positions 0 .. len - 1.
+  // Existing data are kept intact until the new index is written.
+  static bool write(string fileName,string chrom,int len,
+		    SparseCounts *counts_p,SparseCounts *counts_u);
+
+  // Iterating over positions of a chromosome starting at pos
+private:
+  int                  chr_,block_,left_,pos_;
+  const unsigned char *col_pos_,*col_p_,*col_u_;
+public:
+  bool seek(int chr,int pos = 0);
+  bool next(int &pos,unsigned int &count_p,unsigned int &count_u);
+
+private:
+  bool readIndex();
+  void openBlock(int b);
+  static bool writeBlock(FILE *f,vector<unsigned char> *cols,
+			 vector<Block> &blocks,int first,int n);
+};
+
+#endif
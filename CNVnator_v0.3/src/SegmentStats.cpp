@@ -0,0 +1,135 @@
+// C/C++ includes
+#include <cstddef>
+
+// Application includes
+#include "SegmentStats.hh"
+
+const double SegmentStats::VAR_EPS = 1e-12;
+
+SegmentStats::SegmentStats(const double *vals,int n) : vals_(vals),
+						       n_(n > 0 ? n : 0),
+						       n_blocks_(0),
+						       n_levels_(0),
+						       shift_(0),
+						       sum_(NULL),
+						       sum2_(NULL),
+						       min_(NULL),
+						       max_(NULL)
+{
+  sum_  = new double[n_ + 1];
+  sum2_ = new double[n_ + 1];
+  sum_[0] = sum2_[0] = 0;
+  for (int i = 0;i < n_;i++) shift_ += vals_[i];
+  if (n_ > 0) shift_ /= n_;
+  for (int i = 0;i < n_;i++) {
+    double d = vals_[i] - shift_;
+    sum_[i + 1]  = sum_[i]  + d;
+    sum2_[i + 1] = sum2_[i] + d*d;
+  }
+
+  n_blocks_ = (n_ + BLOCK - 1)>>BLOCK_BITS;
+  n_levels_ = 1;
+  while ((1<<n_levels_) <= n_blocks_) n_levels_++;
+  min_ = new double*[n_levels_];
+  max_ = new double*[n_levels_];
+  min_[0] = new double[n_blocks_ + 1];
+  max_[0] = new double[n_blocks_ + 1];
+  for (int b = 0;b < n_blocks_;b++) {
+    int s = b<<BLOCK_BITS,e = s + BLOCK; if (e > n_) e = n_;
+    double mi = vals_[s],ma = vals_[s];
+    for (int i = s + 1;i < e;i++) {
+      if (vals_[i] < mi) mi = vals_[i];
+      if (vals_[i] > ma) ma = vals_[i];
+    }
+    min_[0][b] = mi;
+    max_[0][b] = ma;
+  }
+  for (int l = 1;l < n_levels_;l++) {
+    int half = 1<<(l - 1),len = n_blocks_ - (1<<l) + 1;
+    min_[l] = new double[len > 0 ? len : 1];
+    max_[l] = new double[len > 0 ? len : 1];
+    for (int b = 0;b < len;b++) {
+      double a = min_[l - 1][b],c = min_[l - 1][b + half];
+      min_[l][b] = (a < c) ? a : c;
+      a = max_[l - 1][b]; c = max_[l - 1][b + half];
+      max_[l][b] = (a > c) ? a : c;
+    }
+  }
+}
+
+SegmentStats::~SegmentStats()
+{
+  for (int l = 0;l < n_levels_;l++) {
+    delete[] min_[l];
+    delete[] max_[l];
+  }
+  delete[] min_;
+  delete[] max_;
+  delete[] sum_;
+  delete[] sum2_;
+}
+
+double SegmentStats::variance(int start,int stop)
+{
+  int n = stop - start + 1;
+  if (n <= 0) return 0;
+  double over_n = 1./n;
+  double d = (sum_[stop + 1] - sum_[start])*over_n;
+  double var = (sum2_[stop + 1] - sum2_[start])*over_n - d*d;
+  double average = d + shift_;
+  // Rounding of prefix sums leaves residue for constant values, which is
+  // checked for exactly, and may make small variance negative
+  if (var < VAR_EPS*average*average) return 0;
+  if (min(start,stop) == max(start,stop)) return 0;
+  return var;
+}
+
+// First whole block in start .. stop and level of sparse table covering
+// whole blocks; returns -1 if there are no whole blocks
+int SegmentStats::blockRange(int start,int stop,int &level)
+{
+  int first = (start + BLOCK - 1)>>BLOCK_BITS;
+  int last  = ((stop + 1)>>BLOCK_BITS) - 1;
+  if (first > last) return -1;
+  level = 0;
+  while ((2<<level) <= last - first + 1) level++;
+  return first;
+}
+
+double SegmentStats::min(int start,int stop)
+{
+  int level,first = blockRange(start,stop,level);
+  if (first < 0) {
+    double ret = vals_[start];
+    for (int i = start + 1;i <= stop;i++)
+      if (vals_[i] < ret) ret = vals_[i];
+    return ret;
+  }
+  int last = ((stop + 1)>>BLOCK_BITS) - 1;
+  double ret = min_[level][first],tmp = min_[level][last - (1<<level) + 1];
+  if (tmp < ret) ret = tmp;
+  for (int i = start;i < first<<BLOCK_BITS;i++)
+    if (vals_[i] < ret) ret = vals_[i];
+  for (int i = (last + 1)<<BLOCK_BITS;i <= stop;i++)
+    if (vals_[i] < ret) ret = vals_[i];
+  return ret;
+}
+
+double SegmentStats::max(int start,int stop)
+{
+  int level,first = blockRange(start,stop,level);
+  if (first < 0) {
+    double ret = vals_[start];
+    for (int i = start + 1;i <= stop;i++)
+      if (vals_[i] > ret) ret = vals_[i];
+    return ret;
+  }
+  int last = ((stop + 1)>>BLOCK_BITS) - 1;
+  double ret = max_[level][first],tmp = max_[level][last - (1<<level) + 1];
+  if (tmp > ret) ret = tmp;
+  for (int i = start;i < first<<BLOCK_BITS;i++)
+    if (vals_[i] > ret) ret = vals_[i];
+  for (int i = (last + 1)<<BLOCK_BITS;i <= stop;i++)
+    if (vals_[i] > ret) ret = vals_[i];
+  return ret;
+}
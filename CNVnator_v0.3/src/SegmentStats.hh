@@ -0,0 +1,44 @@
+#ifndef __SEGMENTSTATS_HH__
+#define __SEGMENTSTATS_HH__
+
+// Sum, sum of squares, minimum and maximum of values start .. stop
+// (inclusive) of an array, e.g., RD signal of a chromosome, in constant
+// time. Built once per array: prefix sums of values less their mean (so
+// that sums of squares don't cancel catastrophically), and sparse table of
+// minima and maxima over blocks of BLOCK values; parts of blocks at the ends
+// of a range are scanned. The array must stay unchanged while statistics
+// are used.
+class SegmentStats
+{
+private:
+  static const int BLOCK_BITS = 5,BLOCK = 1<<BLOCK_BITS;
+  static const double VAR_EPS; // Variances below VAR_EPS*mean^2 are 0
+
+  const double *vals_;
+  int           n_,n_blocks_,n_levels_;
+  double        shift_;       // Mean of values
+  double       *sum_,*sum2_;  // Prefix sums of values - shift_ and squares
+  double      **min_,**max_;  // Per level: over 2^level blocks from block i
+
+public:
+  SegmentStats(const double *vals,int n);
+  ~SegmentStats();
+
+  inline int    size() { return n_; }
+  inline double sum(int start,int stop)
+  {
+    return sum_[stop + 1] - sum_[start] + (stop - start + 1)*shift_;
+  }
+  // Variance (mean of squares less square of mean); exactly 0 for constant
+  // values, and never negative
+  double variance(int start,int stop);
+  double min(int start,int stop);
+  double max(int start,int stop);
+
+private:
+  SegmentStats(const SegmentStats&);
+  SegmentStats &operator=(const SegmentStats&);
+  int blockRange(int start,int stop,int &level);
+};
+
+#endif
@@ -0,0 +1,63 @@
+// ROOT includes
+#include <TMath.h>
+#include <TH1D.h>
+
+// Application includes
+#include "Segments.hh"
+
+void Segments::add(int start,int stop,double level)
+{
+  Segment seg;
+  seg.start = start;
+  seg.stop  = stop;
+  seg.n     = stop - start + 1;
+  seg.level = level;
+  seg.sum   = seg.var = 0;
+  segs_.push_back(seg);
+}
+
+void Segments::build(const double *level,int n_bins,double precision)
+{
+  segs_.clear();
+  for (int b = 0;b < n_bins;) {
+    int start = b;
+    while (b < n_bins && TMath::Abs(level[b] - level[start]) < precision) b++;
+    add(start,b - 1,level[start]);
+  }
+}
+
+void Segments::setStats(SegmentStats &rd)
+{
+  for (unsigned int i = 0;i < segs_.size();i++) {
+    segs_[i].sum  = rd.sum(segs_[i].start,segs_[i].stop);
+    segs_[i].var  = rd.variance(segs_[i].start,segs_[i].stop);
+  }
+}
+
+TH1 *Segments::makeHistogram(TString name)
+{
+  int n = segs_.size();
+  TH1 *his = new TH1D(name,"Last bins of partition segments",
+		      n,0.5,n + 0.5);
+  his->SetDirectory(0);
+  for (int i = 0;i < n;i++) his->SetBinContent(i + 1,segs_[i].stop);
+  return his;
+}
+
+bool Segments::read(TH1 *his,const double *level,int n_bins)
+{
+  segs_.clear();
+  int n = his->GetNbinsX(),start = 0;
+  for (int i = 1;i <= n;i++) {
+    int stop = int(his->GetBinContent(i) + 0.5);
+    if (stop < start || stop >= n_bins) {
+      segs_.clear();
+      return false;
+    }
+    add(start,stop,level[start]);
+    start = stop + 1;
+  }
+  if (start == n_bins) return true;
+  segs_.clear();
+  return false;
+}
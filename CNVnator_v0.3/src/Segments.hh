@@ -0,0 +1,50 @@
+#ifndef __SEGMENTS_HH__
+#define __SEGMENTS_HH__
+
+// C/C++ includes
+#include <vector>
+using namespace std;
+
+// ROOT includes
+#include <TROOT.h>
+#include <TH1.h>
+
+// Application includes
+#include "SegmentStats.hh"
+
+// Bins start .. stop (inclusive) of partition with the same level
+struct Segment
+{
+  int    start,stop,n;
+  double level;    // Level of the first bin
+  double sum,var;  // Sum and variance of RD, set by setStats()
+};
+
+// Segments of partition of chromosome, in order. Bins belong to the same
+// segment while their level differs from that of its first bin by less
+// than precision, as scanning bins from the left finds them. Kept along
+// with levels per bin, and written into root file, next to partition, as
+// histogram of last bins of segments.
+class Segments
+{
+private:
+  vector<Segment> segs_;
+
+public:
+  inline int      size()            { return segs_.size(); }
+  inline Segment &operator[](int i) { return segs_[i]; }
+  inline void     clear()           { segs_.clear(); }
+
+  void add(int start,int stop,double level);
+  void build(const double *level,int n_bins,double precision);
+  void setStats(SegmentStats &rd);
+
+  // Histogram with last bin of each segment; caller deletes it
+  TH1 *makeHistogram(TString name);
+
+  // Segments from such histogram, levels from partition. False if they
+  // don't cover n_bins bins
+  bool read(TH1 *his,const double *level,int n_bins);
+};
+
+#endif
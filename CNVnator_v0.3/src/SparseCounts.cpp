@@ -0,0 +1,209 @@
+// C/C++ includes
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+// Application includes
+#include "SparseCounts.hh"
+
+SparseCounts::SparseCounts(int len) : len_(len),
+				      n_chunks_(0),
+				      chunks_(NULL),
+				      top_(0),
+				      chunk_(0),
+				      offset_(0),
+				      pos_(-1)
+{
+  if (len_ < 0) len_ = 0;
+  n_chunks_ = (len_>>CHUNK_BITS) + 1;
+  chunks_ = new Chunk[n_chunks_];
+  for (int i = 0;i < n_chunks_;i++) {
+    Chunk &ch = chunks_[i];
+    ch.data = NULL;
+    ch.size = ch.capacity = 0;
+    ch.prev = ch.last = -1;
+    ch.last_count = 0;
+    ch.pending = NULL;
+    ch.n_pending = ch.max_pending = 0;
+  }
+}
+
+SparseCounts::~SparseCounts()
+{
+  for (int i = 0;i < n_chunks_;i++) {
+    free(chunks_[i].data);
+    delete[] chunks_[i].pending;
+  }
+  delete[] chunks_;
+}
+
+long SparseCounts::memory()
+{
+  long ret = n_chunks_*sizeof(Chunk);
+  for (int i = 0;i < n_chunks_;i++) {
+    ret += chunks_[i].capacity;
+    ret += 2*chunks_[i].max_pending*sizeof(int);
+  }
+  return ret;
+}
+
+void SparseCounts::put(Chunk &ch,unsigned int val)
+{
+  if (ch.size + 5 > ch.capacity) {
+    ch.capacity += ch.capacity/2 + 16;
+    ch.data = (unsigned char*)realloc(ch.data,ch.capacity);
+  }
+  while (val >= 0x80) {
+    ch.data[ch.size++] = (val & 0x7f) | 0x80;
+    val >>= 7;
+  }
+  ch.data[ch.size++] = val;
+}
+
+unsigned int SparseCounts::get(const unsigned char *data,int &offset)
+{
+  unsigned int ret = 0;
+  int shift = 0;
+  unsigned char c;
+  do {
+    c = data[offset++];
+    ret |= (unsigned int)(c & 0x7f)<<shift;
+    shift += 7;
+  } while (c & 0x80);
+  return ret;
+}
+
+// Appends count at position pos, which must be after ch.prev
+void SparseCounts::encode(Chunk &ch,int pos,unsigned int count)
+{
+  unsigned int gap = pos - ch.prev - 1;
+  if (count > 1) {
+    put(ch,gap<<1 | 1);
+    put(ch,count);
+  } else put(ch,gap<<1);
+  ch.prev = pos;
+}
+
+// Merges in pending counts of chunks left behind, as positions out of order
+// are close to those in order
+void SparseCounts::moveTo(int chunk)
+{
+  for (int i = top_ - 1;i < chunk - 1;i++)
+    if (i >= 0 && chunks_[i].n_pending > 0) flush(chunks_[i]);
+  top_ = chunk;
+}
+
+void SparseCounts::addPending(Chunk &ch,int pos,int count)
+{
+  if (ch.n_pending == ch.max_pending) {
+    int max = ch.max_pending ? 2*ch.max_pending : MIN_PENDING;
+    int *tmp = new int[2*max];
+    if (ch.n_pending > 0)
+      memcpy(tmp,ch.pending,2*ch.n_pending*sizeof(int));
+    delete[] ch.pending;
+    ch.pending = tmp;
+    ch.max_pending = max;
+  }
+  ch.pending[2*ch.n_pending]     = pos;
+  ch.pending[2*ch.n_pending + 1] = count;
+  if (++ch.n_pending == MAX_PENDING) flush(ch);
+}
+
+// Encodes position with count not yet encoded and merges in pending counts
+void SparseCounts::flush(Chunk &ch)
+{
+  if (ch.last >= 0) encode(ch,ch.last,ch.last_count);
+  ch.last = -1;
+  ch.last_count = 0;
+  if (ch.n_pending == 0) return;
+
+  // Sorting pending counts by position; position goes to upper bits
+  long *pend = new long[ch.n_pending];
+  for (int i = 0;i < ch.n_pending;i++)
+    pend[i] = (long)ch.pending[2*i]<<32 | ch.pending[2*i + 1];
+  std::sort(pend,pend + ch.n_pending);
+
+  Chunk old = ch;
+  ch.data = NULL;
+  ch.size = ch.capacity = 0;
+  ch.prev = -1;
+  int offset = 0,old_pos = -1,i = 0;
+  unsigned int old_count = 0;
+  bool has_old = false;
+  while (true) {
+    if (!has_old && offset < old.size) {
+      unsigned int val = get(old.data,offset);
+      old_pos  += (val>>1) + 1;
+      old_count = (val & 1) ? get(old.data,offset) : 1;
+      has_old = true;
+    }
+    if (!has_old && i >= old.n_pending) break;
+    int pos = has_old ? old_pos : CHUNK;
+    if (i < old.n_pending && (int)(pend[i]>>32) < pos) pos = pend[i]>>32;
+    unsigned int count = 0;
+    if (has_old && old_pos == pos) {
+      count += old_count;
+      has_old = false;
+    }
+    for (;i < old.n_pending && (int)(pend[i]>>32) == pos;i++)
+      count += (unsigned int)(pend[i] & 0xffffffff);
+    encode(ch,pos,count);
+  }
+  free(old.data);
+  delete[] pend;
+  delete[] ch.pending;
+  ch.pending = NULL;
+  ch.n_pending = ch.max_pending = 0;
+}
+
+void SparseCounts::rewind()
+{
+  for (int i = 0;i < n_chunks_;i++) flush(chunks_[i]);
+  chunk_  = 0;
+  offset_ = 0;
+  pos_    = -1;
+}
+
+bool SparseCounts::next(int &pos,unsigned int &count)
+{
+  while (chunk_ < n_chunks_) {
+    Chunk &ch = chunks_[chunk_];
+    if (offset_ < ch.size) {
+      unsigned int val = get(ch.data,offset_);
+      pos_ += (val>>1) + 1;
+      count = (val & 1) ? get(ch.data,offset_) : 1;
+      pos = (chunk_<<CHUNK_BITS) + pos_;
+      return true;
+    }
+    chunk_++;
+    offset_ = 0;
+    pos_    = -1;
+  }
+  return false;
+}
+
+SparseCountsPair::SparseCountsPair(SparseCounts *a,SparseCounts *b) :
+  a_(a),b_(b),pos_a_(-1),pos_b_(-1),cnt_a_(0),cnt_b_(0)
+{
+  if (a_) a_->rewind();
+  if (b_) b_->rewind();
+  has_a_ = a_ && a_->next(pos_a_,cnt_a_);
+  has_b_ = b_ && b_->next(pos_b_,cnt_b_);
+}
+
+bool SparseCountsPair::next(int &pos,unsigned int &count_a,
+			    unsigned int &count_b)
+{
+  if (!has_a_ && !has_b_) return false;
+  pos = (has_a_ && (!has_b_ || pos_a_ <= pos_b_)) ? pos_a_ : pos_b_;
+  count_a = count_b = 0;
+  if (has_a_ && pos_a_ == pos) {
+    count_a = cnt_a_;
+    has_a_ = a_->next(pos_a_,cnt_a_);
+  }
+  if (has_b_ && pos_b_ == pos) {
+    count_b = cnt_b_;
+    has_b_ = b_->next(pos_b_,cnt_b_);
+  }
+  return true;
+}
@@ -0,0 +1,88 @@
+#ifndef __SPARSECOUNTS_HH__
+#define __SPARSECOUNTS_HH__
+
+// Counts per position 0 .. len of a chromosome, kept in chunks of
+// CHUNK positions. Non-zero counts of a chunk are stored as a byte string
+// of varints: gap to previous non-zero position (shifted left by one, lowest
+// bit set if count is larger than one) followed by count if it is larger
+// than one. Adding in non-decreasing order of positions is O(1); positions
+// that come out of order are buffered in small growing buffer and merged
+// in when it fills or when adding moves two chunks past, so that sorted
+// input keeps buffers only for last chunks.
+class SparseCounts
+{
+private:
+  static const int CHUNK_BITS = 16,CHUNK = 1<<CHUNK_BITS;
+  static const int MIN_PENDING = 16,MAX_PENDING = 4096;
+
+  struct Chunk
+  {
+    unsigned char *data; // Encoded counts
+    int size,capacity;
+    int prev;            // Last encoded position, -1 if none
+    int last;            // Position with count not yet encoded, -1 if none
+    unsigned int last_count;
+    int *pending;        // Pairs of position and count out of order
+    int n_pending,max_pending;
+  };
+
+  int    len_,n_chunks_;
+  Chunk *chunks_;
+  int    top_;               // Highest chunk added to
+
+public:
+  SparseCounts(int len);
+  ~SparseCounts();
+
+  inline int length() { return len_; }
+
+  // Adds count to position pos
+  inline void add(int pos,int count = 1)
+  {
+    if (pos < 0 || pos > len_ || count <= 0) return;
+    if ((pos>>CHUNK_BITS) > top_) moveTo(pos>>CHUNK_BITS);
+    Chunk &ch = chunks_[pos>>CHUNK_BITS];
+    pos &= CHUNK - 1;
+    if (pos == ch.last) ch.last_count += count;
+    else if (pos > ch.last && pos > ch.prev) {
+      if (ch.last >= 0) encode(ch,ch.last,ch.last_count);
+      ch.last = pos;
+      ch.last_count = count;
+    } else addPending(ch,pos,count);
+  }
+
+  // Memory used by counts, in bytes
+  long memory();
+
+  // Iterating over non-zero counts in increasing order of positions
+private:
+  int chunk_,offset_,pos_;
+public:
+  void rewind();
+  bool next(int &pos,unsigned int &count);
+
+private:
+  void encode(Chunk &ch,int pos,unsigned int count);
+  void moveTo(int chunk);
+  void addPending(Chunk &ch,int pos,int count);
+  void flush(Chunk &ch);
+  void put(Chunk &ch,unsigned int val);
+  static unsigned int get(const unsigned char *data,int &offset);
+};
+
+// Iterating over positions with non-zero count in any of two containers,
+// either of which can be NULL
+class SparseCountsPair
+{
+private:
+  SparseCounts *a_,*b_;
+  bool          has_a_,has_b_;
+  int           pos_a_,pos_b_;
+  unsigned int  cnt_a_,cnt_b_;
+
+public:
+  SparseCountsPair(SparseCounts *a,SparseCounts *b);
+  bool next(int &pos,unsigned int &count_a,unsigned int &count_b);
+};
+
+#endif
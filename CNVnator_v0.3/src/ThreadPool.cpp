@@ -0,0 +1,73 @@
+// Application includes
+#include "ThreadPool.hh"
+
+struct ThreadData
+{
+  ThreadPool *pool;
+  int         thread;
+};
+
+ThreadPool::ThreadPool(int nThreads) : n_threads_(nThreads),
+				       task_(NULL),
+				       arg_(NULL),
+				       n_jobs_(0),
+				       next_job_(0)
+{
+  if (n_threads_ < 1) n_threads_ = 1;
+  pthread_mutex_init(&job_lock_,NULL);
+  pthread_mutex_init(&out_lock_,NULL);
+}
+
+ThreadPool::~ThreadPool()
+{
+  pthread_mutex_destroy(&job_lock_);
+  pthread_mutex_destroy(&out_lock_);
+}
+
+int ThreadPool::nextJob()
+{
+  pthread_mutex_lock(&job_lock_);
+  int ret = -1;
+  if (next_job_ < n_jobs_) ret = next_job_++;
+  pthread_mutex_unlock(&job_lock_);
+  return ret;
+}
+
+void *ThreadPool::work(void *data)
+{
+  ThreadData *td = (ThreadData*)data;
+  ThreadPool *pool = td->pool;
+  int job;
+  while ((job = pool->nextJob()) >= 0)
+    pool->task_(job,td->thread,pool->arg_);
+  return NULL;
+}
+
+void ThreadPool::run(Task task,void *arg,int n_jobs)
+{
+  if (!task || n_jobs <= 0) return;
+  task_     = task;
+  arg_      = arg;
+  n_jobs_   = n_jobs;
+  next_job_ = 0;
+
+  int n = n_threads_; if (n > n_jobs) n = n_jobs;
+  ThreadData *tds  = new ThreadData[n];
+  pthread_t  *tids = new pthread_t[n];
+  for (int i = 0;i < n;i++) {
+    tds[i].pool   = this;
+    tds[i].thread = i;
+  }
+  // Thread 0 is the caller
+  int n_started = 1;
+  for (int i = 1;i < n;i++)
+    if (pthread_create(&tids[i],NULL,work,&tds[i]) == 0) n_started++;
+    else break;
+  work(&tds[0]);
+  for (int i = 1;i < n_started;i++) pthread_join(tids[i],NULL);
+
+  delete[] tds;
+  delete[] tids;
+  task_ = NULL;
+  arg_  = NULL;
+}
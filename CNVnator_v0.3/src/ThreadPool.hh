@@ -0,0 +1,39 @@
+#ifndef __THREADPOOL_HH__
+#define __THREADPOOL_HH__
+
+// C/C++ includes
+#include <pthread.h>
+
+class ThreadPool
+{
+public:
+  // Job index, index of the thread running the job, user data
+  typedef void (*Task)(int job,int thread,void *arg);
+
+private:
+  int  n_threads_;
+  Task task_;
+  void *arg_;
+  int  n_jobs_,next_job_;
+  pthread_mutex_t job_lock_,out_lock_;
+
+public:
+  ThreadPool(int nThreads = 1);
+  ~ThreadPool();
+
+  inline int numThreads() { return n_threads_; }
+
+  // Runs jobs 0 .. n_jobs-1 and returns when all are done. Jobs are handed
+  // out in increasing order, so put the longest ones first.
+  void run(Task task,void *arg,int n_jobs);
+
+  // Serializing output (or anything else) from within jobs
+  inline void lock()   { pthread_mutex_lock(&out_lock_); }
+  inline void unlock() { pthread_mutex_unlock(&out_lock_); }
+
+private:
+  int nextJob();
+  static void *work(void *data);
+};
+
+#endif
@@ -0,0 +1,358 @@
+// C/C++ includes
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <vector>
+using namespace std;
+
+// ROOT includes
+#include <TROOT.h>
+#include <TFile.h>
+#include <TH1D.h>
+#include <TMath.h>
+#include <TRandom3.h>
+#include <TStopwatch.h>
+
+// Application includes
+#include "HisMaker.hh"
+#include "Genome.hh"
+#include "Metrics.hh"
+
+// Benchmark of partitioning and calling on synthetic RD signal. Chromosomes
+// of given lengths get read depth drawn from negative binomial (Poisson
+// when dispersion is 0), GC bias following GC-content that wanders along
+// chromosome, and planted deletions (one copy lost) and duplications (one
+// copy gained) of given sizes. Signal is GC corrected the way -his does it
+// (by average RD per GC percent) and written into root file as -his and
+// -stat would. Then partition and calls are made and timed per bin size
+// and chromosome, and planted CNVs found by calls are counted.
+
+static const int    GC_STEP   = 1000; // GC-content changes every GC_STEP bp
+static const double GC_MEAN   = 0.42;
+static const double UNIQUE    = 0.97; // Fraction of uniquely mapped reads
+
+struct Planted
+{
+  int  start,end; // 1-based, inclusive
+  bool deletion;
+  int  size_index;
+};
+
+struct Call
+{
+  int  start,end;
+  bool deletion;
+};
+
+static bool parseList(string s,vector<int> &vals)
+{
+  vals.clear();
+  istringstream in(s);
+  string item;
+  while (getline(in,item,',')) {
+    int v = atoi(item.c_str());
+    if (v <= 0) return false;
+    vals.push_back(v);
+  }
+  return vals.size() > 0;
+}
+
+// Gamma distributed with given shape and mean 1 (Marsaglia and Tsang)
+static double gammaUnit(TRandom3 &rnd,double shape)
+{
+  if (shape < 1) {
+    double u = rnd.Rndm();
+    return gammaUnit(rnd,shape + 1)*(shape + 1)/shape*TMath::Power(u,1/shape);
+  }
+  double d = shape - 1./3,c = 1/TMath::Sqrt(9*d);
+  while (true) {
+    double x = rnd.Gaus(),v = 1 + c*x;
+    if (v <= 0) continue;
+    v = v*v*v;
+    double u = rnd.Rndm();
+    if (u < 1 - 0.0331*x*x*x*x)               return d*v/shape;
+    if (log(u) < 0.5*x*x + d*(1 - v + log(v))) return d*v/shape;
+  }
+}
+
+// CNVs of each size, alternating deletions and duplications, not
+// overlapping and apart by at least the size of larger one
+static void plantCNVs(TRandom3 &rnd,int len,vector<int> &sizes,int n_per_size,
+		      vector<Planted> &planted)
+{
+  planted.clear();
+  for (int s = sizes.size() - 1;s >= 0;s--)
+    for (int i = 0;i < n_per_size;i++)
+      for (int attempt = 0;attempt < 1000;attempt++) {
+	Planted p;
+	p.start = 1 + int(rnd.Rndm()*(len - sizes[s]));
+	p.end   = p.start + sizes[s] - 1;
+	p.deletion   = (i%2 == 0);
+	p.size_index = s;
+	bool ok = (p.start > sizes[s] && p.end + sizes[s] < len);
+	for (unsigned int j = 0;ok && j < planted.size();j++) {
+	  int gap = sizes[planted[j].size_index];
+	  if (p.start <= planted[j].end + gap && p.end + gap >= planted[j].start)
+	    ok = false;
+	}
+	if (!ok) continue;
+	planted.push_back(p);
+	break;
+      }
+}
+
+static void makeGC(TRandom3 &rnd,int len,vector<double> &gc)
+{
+  int n = len/GC_STEP + 1;
+  gc.resize(n);
+  double g = GC_MEAN;
+  for (int i = 0;i < n;i++) {
+    g += 0.1*(GC_MEAN - g) + 0.02*rnd.Gaus();
+    if (g < 0.25) g = 0.25;
+    if (g > 0.65) g = 0.65;
+    gc[i] = g;
+  }
+}
+
+// Raw, GC corrected and unique RD signal of chromosome for bin size
+static void makeSignal(TRandom3 &rnd,int len,int bin,double depth,
+		       double dispersion,double gc_bias,vector<double> &gc,
+		       vector<Planted> &planted,TH1 *raw,TH1 *corr,TH1 *uniq)
+{
+  int n_bins = len/bin;
+  vector<double> copy(n_bins,1.);
+  for (unsigned int i = 0;i < planted.size();i++) {
+    double ratio = planted[i].deletion ? 0.5 : 1.5;
+    int b1 = (planted[i].start - 1)/bin,b2 = (planted[i].end - 1)/bin;
+    for (int b = b1;b <= b2 && b < n_bins;b++) {
+      int s = b*bin + 1,e = (b + 1)*bin;
+      if (s < planted[i].start) s = planted[i].start;
+      if (e > planted[i].end)   e = planted[i].end;
+      copy[b] += (ratio - 1)*(e - s + 1)/bin;
+    }
+  }
+
+  double mean = depth*bin/100;
+  vector<double> rd(n_bins),bin_gc(n_bins);
+  double gc_sum[101] = {0},gc_n[101] = {0},all_sum = 0;
+  for (int b = 0;b < n_bins;b++) {
+    bin_gc[b] = gc[(b*bin + bin/2)/GC_STEP];
+    double x = (bin_gc[b] - GC_MEAN)/0.2;
+    double mu = mean*copy[b]*(1 - gc_bias*x*x);
+    if (mu < 0) mu = 0;
+    if (dispersion > 0) mu *= gammaUnit(rnd,dispersion);
+    double count = rnd.Poisson(mu);
+    rd[b] = count;
+    raw->SetBinContent(b + 1,count);
+    uniq->SetBinContent(b + 1,rnd.Binomial(int(count),UNIQUE));
+    int g = int(100*bin_gc[b] + 0.5);
+    gc_sum[g] += count;
+    gc_n[g]++;
+    all_sum += count;
+  }
+
+  double all_mean = all_sum/n_bins;
+  for (int b = 0;b < n_bins;b++) {
+    int g = int(100*bin_gc[b] + 0.5);
+    double gc_mean = gc_sum[g]/gc_n[g];
+    corr->SetBinContent(b + 1,(gc_mean > 0) ? rd[b]*all_mean/gc_mean : 0);
+  }
+}
+
+static bool overlaps(int s1,int e1,int s2,int e2)
+{
+  int s = (s1 > s2) ? s1 : s2,e = (e1 < e2) ? e1 : e2;
+  if (e < s) return false;
+  double ov = e - s + 1;
+  return ov >= 0.5*(e1 - s1 + 1) && ov >= 0.5*(e2 - s2 + 1);
+}
+
+static void parseCalls(string text,vector<Call> &calls)
+{
+  calls.clear();
+  istringstream in(text);
+  string line;
+  while (getline(in,line)) {
+    istringstream fields(line);
+    string type,coor;
+    fields>>type>>coor;
+    int colon = coor.find(':'),dash = coor.find('-',colon);
+    if (colon < 0 || dash < 0) continue;
+    Call c;
+    c.start    = atoi(coor.substr(colon + 1,dash - colon - 1).c_str());
+    c.end      = atoi(coor.substr(dash + 1).c_str());
+    c.deletion = (type == "deletion");
+    calls.push_back(c);
+  }
+}
+
+int main(int argc,char *argv[])
+{
+  string usage = "\nUsage:\n";
+  usage += argv[0];
+  usage += " [-root bench.root] [-bins 100,1000] [-lengths 10000000,...]\n";
+  usage += "\t[-depth 50] [-dispersion 20] [-gc 0.3]";
+  usage += " [-sizes 1000,5000,20000,100000]\n";
+  usage += "\t[-cnvs 10] [-threads N] [-seed 1]\n";
+
+  string root_file = "bench.root";
+  vector<int> bins,lengths,sizes;
+  parseList("100,1000",bins);
+  parseList("10000000,50000000",lengths);
+  parseList("1000,5000,20000,100000",sizes);
+  double depth = 50,dispersion = 20,gc_bias = 0.3;
+  int n_per_size = 10,n_threads = 1,seed = 1;
+  for (int i = 1;i < argc;i++) {
+    string option = argv[i];
+    if (i + 1 >= argc) {
+      cerr<<"No value for option '"<<option<<"'."<<endl<<usage;
+      return 1;
+    }
+    string value = argv[++i];
+    bool ok = true;
+    if      (option == "-root")       root_file  = value;
+    else if (option == "-bins")       ok = parseList(value,bins);
+    else if (option == "-lengths")    ok = parseList(value,lengths);
+    else if (option == "-sizes")      ok = parseList(value,sizes);
+    else if (option == "-depth")      depth      = atof(value.c_str());
+    else if (option == "-dispersion") dispersion = atof(value.c_str());
+    else if (option == "-gc")         gc_bias    = atof(value.c_str());
+    else if (option == "-cnvs")       n_per_size = atoi(value.c_str());
+    else if (option == "-threads")    n_threads  = atoi(value.c_str());
+    else if (option == "-seed")       seed       = atoi(value.c_str());
+    else {
+      cerr<<"Unknown option '"<<option<<"'."<<endl<<usage;
+      return 1;
+    }
+    if (!ok || depth <= 0 || n_per_size < 0) {
+      cerr<<"Invalid value '"<<value<<"' for option '"<<option<<"'."<<endl;
+      return 1;
+    }
+  }
+
+  // Chromosomes with GC-content and planted CNVs, the same for all bins
+  TRandom3 rnd(seed);
+  int n_chroms = lengths.size();
+  vector<string> chroms(n_chroms);
+  vector< vector<double> >  gc(n_chroms);
+  vector< vector<Planted> > planted(n_chroms);
+  for (int c = 0;c < n_chroms;c++) {
+    ostringstream name;
+    name<<"chrbench"<<c + 1;
+    chroms[c] = name.str();
+    makeGC(rnd,lengths[c],gc[c]);
+    plantCNVs(rnd,lengths[c],sizes,n_per_size,planted[c]);
+  }
+
+  // Made before file is opened, so that its histograms are not put there
+  HisMaker names(root_file);
+  TFile file(root_file.c_str(),"RECREATE");
+  if (file.IsZombie()) {
+    cerr<<"Can't create file '"<<root_file<<"'."<<endl;
+    return 1;
+  }
+  for (unsigned int ib = 0;ib < bins.size();ib++) {
+    int bin = bins[ib];
+    TDirectory *dir = file.mkdir(names.getDirName(bin));
+    dir->cd();
+    TH1 *distr = new TH1D(names.getDistrName(chrAll,bin,false,true),
+			  "RD all (GC corrected)",5001,-0.5,5000.5);
+    for (int c = 0;c < n_chroms;c++) {
+      TString name = chroms[c];
+      int n_bins = lengths[c]/bin,len = n_bins*bin;
+      TH1 *raw  = new TH1D(names.getSignalName(name,bin,false,false),
+			   "RD",n_bins,0,len);
+      TH1 *corr = new TH1D(names.getSignalName(name,bin,false,true),
+			   "RD (GC corrected)",n_bins,0,len);
+      TH1 *uniq = new TH1D(names.getUSignalName(name,bin),
+			   "RD unique",n_bins,0,len);
+      makeSignal(rnd,lengths[c],bin,depth,dispersion,gc_bias,gc[c],
+		 planted[c],raw,corr,uniq);
+      for (int b = 1;b <= n_bins;b++) distr->Fill(corr->GetBinContent(b));
+      raw->Write();
+      corr->Write();
+      uniq->Write();
+      delete raw;
+      delete corr;
+      delete uniq;
+    }
+    distr->Write();
+    delete distr;
+  }
+  file.Close();
+
+  // Phases are timed by records HisMaker makes for -metrics (never written)
+  static const int N_PHASES = 5;
+  const char *steps[N_PHASES]  = {"partition","partition","call","call",
+				  "call"};
+  const char *phases[N_PHASES] = {"levels","mask","merge","refine",
+				  "evaluate"};
+  Metrics metrics("");
+  cout<<"bin\tlength\tbins\tpartition_s\tbins/s\tcall_s\tbins/s";
+  for (int p = 0;p < N_PHASES;p++) cout<<"\t"<<phases[p]<<"_s";
+  cout<<"\tcalls\ttrue_calls"<<endl;
+  ostringstream sens;
+  for (unsigned int ib = 0;ib < bins.size();ib++) {
+    int bin = bins[ib];
+    HisMaker maker(root_file,bin,true);
+    maker.setNumThreads(n_threads);
+    maker.setMetrics(&metrics);
+    vector<int> n_planted(sizes.size(),0),n_found(sizes.size(),0);
+    for (int c = 0;c < n_chroms;c++) {
+      string chrom = chroms[c];
+      int n_bins = lengths[c]/bin;
+
+      // Progress messages of partition are dropped, calls are kept
+      ostringstream out;
+      streambuf *cout_buf = cout.rdbuf(out.rdbuf());
+      TStopwatch watch;
+      maker.partition(&chrom,1,false,false,true);
+      double t_partition = watch.RealTime();
+      out.str("");
+      watch.Start();
+      maker.callSVs(&chrom,1,false,true,false);
+      double t_call = watch.RealTime();
+      cout.rdbuf(cout_buf);
+
+      vector<Call> calls;
+      parseCalls(out.str(),calls);
+      int n_true = 0;
+      for (unsigned int i = 0;i < calls.size();i++)
+	for (unsigned int j = 0;j < planted[c].size();j++)
+	  if (calls[i].deletion == planted[c][j].deletion &&
+	      overlaps(calls[i].start,calls[i].end,
+		       planted[c][j].start,planted[c][j].end)) {
+	    n_true++;
+	    break;
+	  }
+      for (unsigned int j = 0;j < planted[c].size();j++) {
+	Planted &p = planted[c][j];
+	n_planted[p.size_index]++;
+	for (unsigned int i = 0;i < calls.size();i++)
+	  if (calls[i].deletion == p.deletion &&
+	      overlaps(calls[i].start,calls[i].end,p.start,p.end)) {
+	    n_found[p.size_index]++;
+	    break;
+	  }
+      }
+
+      cout<<bin<<"\t"<<lengths[c]<<"\t"<<n_bins<<"\t"
+	  <<t_partition<<"\t"<<n_bins/t_partition<<"\t"
+	  <<t_call<<"\t"<<n_bins/t_call;
+      for (int p = 0;p < N_PHASES;p++) {
+	double t = metrics.wallTime(steps[p],phases[p],chrom);
+	if (t >= 0) cout<<"\t"<<t;
+	else        cout<<"\tNA";
+      }
+      cout<<"\t"<<calls.size()<<"\t"<<n_true<<endl;
+      metrics.clear();
+    }
+    for (unsigned int s = 0;s < sizes.size();s++)
+      sens<<bin<<"\t"<<sizes[s]<<"\t"<<n_planted[s]<<"\t"<<n_found[s]<<"\t"
+	  <<(n_planted[s] > 0 ? double(n_found[s])/n_planted[s] : 0)<<endl;
+  }
+  cout<<endl<<"bin\tcnv_size\tplanted\tfound\tsensitivity"<<endl
+      <<sens.str();
+
+  return 0;
+}
@@ -17,27 +17,36 @@ int main(int argc,char *argv[])
 #endif
   usage += "\n\nUsage:\n";
   usage += argv[0];
-  usage += " -root out.root  [-genome name] [-chrom 1 2 ...] -tree  file1.bam ...\n";
+  usage += " -root out.root  [-genome name] [-chrom 1 2 ...] -tree  file1.bam ... [-threads N] [-rd]\n";
   usage += argv[0];
-  usage += " -root out.root  [-genome name] [-chrom 1 2 ...] -merge file1.root ...\n";
+  usage += " -root out.root  [-genome name] [-chrom 1 2 ...] -tree  file1.bam ... -bins 100,500,... [-d dir] [-threads N]\n";
   usage += argv[0];
-  usage += " -root file.root [-genome name] [-chrom 1 2 ...] [-d dir] -his bin_size\n";
+  usage += " -root out.root  [-genome name] [-chrom 1 2 ...] -merge file1.root ... [-rd]\n";
   usage += argv[0];
-  usage += " -root file.root [-chrom 1 2 ...] -stat      bin_size\n";
+  usage += " -root file.root [-genome name] [-chrom 1 2 ...] [-d dir] -his bin_size[,bin_size ...] [-threads N]\n";
+  usage += argv[0];
+  usage += "                 [-genome name] [-chrom 1 2 ...] [-d dir] -prepare-reference bin_size[,bin_size ...] [-threads N]\n";
+  usage += argv[0];
+  usage += " -root file.root [-chrom 1 2 ...] -stat      bin_size [-threads N] [-nogcqc]\n";
   usage += argv[0];
   usage += " -root file.root                  -eval      bin_size\n";
   usage += argv[0];
-  usage += " -root file.root [-chrom 1 2 ...] -partition bin_size [-ngc]\n";
+  usage += " -root file.root [-chrom 1 2 ...] -partition bin_size [-ngc] [-threads N] [-adaptive [mask_tol]]\n";
   // usage += argv[0];
   //usage += " -root file.root [-chrom 1 2 ...] -spartition bin_size [-gc]\n";
   usage += argv[0];
-  usage += " -root file.root [-chrom 1 2 ...] -call      bin_size [-ngc]\n";
+  usage += " -root file.root [-chrom 1 2 ...] -call      bin_size [-ngc] [-threads N]\n";
   usage += argv[0];
   usage += " -root file.root -genotype bin_size [-ngc]\n";
   usage += argv[0];
   usage += " -root file.root -view     bin_size [-ngc]\n";
   usage += argv[0];
-  usage += " -pe   file1.bam ... -qual val(20) -over val(0.8) [-f file]\n";
+  usage += " -pe   file1.bam ... -qual val(20) -over val(0.8) [-f file] [-threads N]\n";
+  usage += "\n";
+  usage += "Option -metrics file appends time and memory used by steps -tree, -his,\n";
+  usage += "-stat, -partition and -call to file.\n";
+  usage += "Option -fasta file.fa[.gz] reads sequences from one indexed fasta file\n";
+  usage += "(file.fa.fai) instead of files chr1.fa, chr2.fa, ... in dir.\n";
   usage += "\n";
   usage += "Valid genomes (-genome option) are: NCBI36, hg18, GRCh37, hg19\n";
 
@@ -62,16 +71,23 @@ int main(int argc,char *argv[])
   static const int OPT_SPARTITION = 0x1000;
   static const int OPT_HIS_NEW    = 0x2000;
   static const int OPT_AGGREGATE  = 0x4000;
+  static const int OPT_REFERENCE  = 0x8000;
 
   // tree, merge, his, stat, partition, spartition, call, view, genotype
   int max_opts = 10000, n_opts = 0, opts[max_opts], bins[max_opts], gbin = 0;
   for (int i = 0;i < n_opts;i++) bins[i] = 0;
+  // All bin sizes given to -his/-hismerge/-prepare-reference, n_his_bins[o]
+  // of them for option o starting at his_bins[first_his_bin[o]]
+  int his_bins[1000],n_all_his_bins = 0;
+  int first_his_bin[max_opts],n_his_bins[max_opts];
   bool useGCcorr = true,useATcorr = false;
-  bool forUnique = false,relaxCalling = false;
-  string out_root_file(""),call_file("");
+  bool forUnique = false,relaxCalling = false,writeRD = false;
+  bool adaptiveBands = false,gcQC = true;
+  string out_root_file(""),call_file(""),metrics_file(""),fasta_file("");
   string chroms[1000],data_files[100000],root_files[100000] = {""},dir = ".";
   int n_chroms = 0,n_files = 0,n_root_files = 0,range = 128, qual = 20;
-  double over = 0.8;
+  int n_threads = 1,tree_bins[100],n_tree_bins = 0;
+  double over = 0.8,mask_tol = 0;
   Genome *genome = NULL;
 
   int index = 1;
@@ -88,16 +104,34 @@ int main(int argc,char *argv[])
 	       option == "-stat"      || option == "-eval"       ||
 	       option == "-partition" || option == "-spartition" ||
 	       option == "-call"      || option == "-view"       ||
-	       option == "-genotype"  || option == "-aggregate") {
-      int bs = 0;
-      if (index < argc && argv[index][0] != '-') {
-	TString tmp = argv[index++];
-	if (!tmp.IsDigit()) {
-	  cerr<<"Bin size must be integer for option '"<<option<<"'."<<endl;
-	  cerr<<usage<<endl;
-	  return 0;
+	       option == "-genotype"  || option == "-aggregate"  ||
+	       option == "-prepare-reference") {
+      int bs = 0,n_bs = 0,bss[100];
+      bool many = (option == "-his" || option == "-hismerge" ||
+		   option == "-prepare-reference");
+      while (index < argc && argv[index][0] != '-') {
+	TStringToken tok(argv[index++],",");
+	while (tok.NextToken()) {
+	  if (!tok.IsDigit()) {
+	    cerr<<"Bin size must be integer for option '"<<option<<"'."<<endl;
+	    cerr<<usage<<endl;
+	    return 0;
+	  }
+	  if (n_bs < 100) bss[n_bs++] = tok.Atoi();
 	}
-	bs = tmp.Atoi();
+	if (!many) break;
+      }
+      if (n_bs > 1 && !many) {
+	cerr<<"Only one bin size can be given for option '"<<option<<"'."<<endl;
+	cerr<<usage<<endl;
+	return 0;
+      }
+      if (n_bs > 0) bs = bss[0];
+      first_his_bin[n_opts] = n_all_his_bins;
+      n_his_bins[n_opts]    = 0;
+      for (int b = 0;many && b < n_bs && n_all_his_bins < 1000;b++) {
+	his_bins[n_all_his_bins++] = bss[b];
+	n_his_bins[n_opts]++;
       }
       if (option == "-his")        opts[n_opts] = OPT_HIS;
       if (option == "-hismerge")   opts[n_opts] = OPT_HISMERGE;
@@ -110,6 +144,7 @@ int main(int argc,char *argv[])
       if (option == "-his_new")    opts[n_opts] = OPT_HIS_NEW;
       if (option == "-eval")       opts[n_opts] = OPT_EVAL;
       if (option == "-aggregate")  opts[n_opts] = OPT_AGGREGATE;
+      if (option == "-prepare-reference") opts[n_opts] = OPT_REFERENCE;
       bins[n_opts++] = bs;
     } else if (option == "-root") {
       while (index < argc && argv[index][0] != '-')
@@ -136,6 +171,8 @@ int main(int argc,char *argv[])
       }
     } else if (option == "-ngc") {
       useGCcorr = false;
+    } else if (option == "-nogcqc") {
+      gcQC = false;
     } else if (option == "-at") {
       useATcorr = true;
     } else if (option == "-genome") {
@@ -177,12 +214,70 @@ int main(int argc,char *argv[])
 	return 0;
       }
       call_file = argv[index++];
+    } else if (option == "-metrics") {
+      if (index >= argc || argv[index][0] == '-') {
+	cerr<<"No file name is provided."<<endl;
+	cerr<<usage<<endl;
+	return 0;
+      }
+      metrics_file = argv[index++];
+    } else if (option == "-fasta") {
+      if (index >= argc || argv[index][0] == '-') {
+	cerr<<"No file name is provided."<<endl;
+	cerr<<usage<<endl;
+	return 0;
+      }
+      fasta_file = argv[index++];
     } else if (option == "-unique") {
       forUnique = true;
+    } else if (option == "-rd") {
+      writeRD = true;
+    } else if (option == "-threads") {
+      if (index >= argc || argv[index][0] == '-') {
+	cerr<<"No number of threads is provided."<<endl;
+	cerr<<usage<<endl;
+	return 0;
+      }
+      TString tmp = argv[index++];
+      if (!tmp.IsDigit() || tmp.Atoi() <= 0) {
+	cerr<<"Number of threads must be positive integer."<<endl;
+	cerr<<usage<<endl;
+	return 0;
+      }
+      n_threads = tmp.Atoi();
+    } else if (option == "-bins") {
+      while (index < argc && argv[index][0] != '-') {
+	TStringToken tok(argv[index++],",");
+	while (tok.NextToken()) {
+	  if (!tok.IsDigit() || tok.Atoi() <= 0) {
+	    cerr<<"Bin size must be positive integer for option '"
+		<<option<<"'."<<endl;
+	    cerr<<usage<<endl;
+	    return 0;
+	  }
+	  if (n_tree_bins < 100) tree_bins[n_tree_bins++] = tok.Atoi();
+	}
+      }
+      if (n_tree_bins == 0) {
+	cerr<<"No bin sizes are provided."<<endl;
+	cerr<<usage<<endl;
+	return 0;
+      }
     } else if (option == "-range") {
       range = atoi(argv[index++]);
     } else if (option == "-relax") {
       relaxCalling = true;
+    } else if (option == "-adaptive") {
+      adaptiveBands = true;
+      if (index < argc && argv[index][0] != '-') {
+	TString tmp = argv[index++];
+	if (!tmp.IsFloat() || tmp.Atof() < 0 || tmp.Atof() > 1) {
+	  cerr<<"Fraction of bins must be number between 0 and 1."<<endl;
+	  cerr<<usage<<endl;
+	  return 0;
+	}
+	mask_tol = tmp.Atof();
+      }
     } else if (option[0] == '-') {
       cerr<<"Unknown option '"<<option<<"'.\n"<<endl;
     }
@@ -192,36 +287,76 @@ int main(int argc,char *argv[])
   if (out_root_file.length() <= 0)
     cerr<<"WARNING: no name of root-file provided."<<endl;
 
+  Metrics *metrics = NULL;
+  if (metrics_file.length() > 0) metrics = new Metrics(metrics_file);
+  Fasta *fasta = NULL;
+  if (fasta_file.length() > 0) {
+    fasta = new Fasta(fasta_file);
+    if (!fasta->isOpen()) {
+      delete fasta;
+      delete metrics;
+      return 0;
+    }
+  }
+
   for (int o = 0;o < n_opts;o++) {
     int option = opts[o];
     int bin = bins[o]; if (bin <= 0) bin = gbin;
     if (option == OPT_TREE) { // tree
       HisMaker maker(out_root_file,genome);
       maker.setDataDir(dir);
-      maker.produceTrees(chroms,n_chroms,data_files,n_files,forUnique);
+      maker.setFasta(fasta);
+      maker.setNumThreads(n_threads);
+      maker.setMetrics(metrics);
+      maker.setWriteRD(writeRD);
+      maker.produceTrees(chroms,n_chroms,data_files,n_files,forUnique,
+			 tree_bins,n_tree_bins);
+    }
+    if (option == OPT_REFERENCE) { // prepare-reference
+      HisMaker maker(out_root_file,genome);
+      maker.setDataDir(dir);
+      maker.setFasta(fasta);
+      maker.setNumThreads(n_threads);
+      int *rbins = (n_his_bins[o] > 0) ? his_bins + first_his_bin[o] : NULL;
+      maker.prepareReference(chroms,n_chroms,rbins,n_his_bins[o]);
     }
     if (option == OPT_MERGE) { // merge
       HisMaker maker(out_root_file,genome);
+      maker.setWriteRD(writeRD);
       maker.mergeTrees(chroms,n_chroms,data_files,n_files);
     }
     if (option == OPT_HIS ||
 	option == OPT_HISMERGE) { // his
       HisMaker maker(out_root_file,bin,useGCcorr,genome);
       maker.setDataDir(dir);
-      maker.produceHistograms(chroms,n_chroms,root_files,n_root_files,false);
+      maker.setFasta(fasta);
+      maker.setNumThreads(n_threads);
+      maker.setMetrics(metrics);
+      int *hbins = (n_his_bins[o] > 0) ? his_bins + first_his_bin[o] : NULL;
+      maker.produceHistograms(chroms,n_chroms,root_files,n_root_files,false,
+			      hbins,n_his_bins[o]);
       if (option == OPT_HISMERGE)
-	maker.produceHistograms(chroms,n_chroms,root_files,n_root_files,true);
+	maker.produceHistograms(chroms,n_chroms,root_files,n_root_files,true,
+				hbins,n_his_bins[o]);
     }
     if (option == OPT_STAT) { // stat
       HisMaker maker(out_root_file,bin,useGCcorr,genome);
+      maker.setNumThreads(n_threads);
+      maker.setMetrics(metrics);
+      maker.setGCQC(gcQC);
       maker.stat(chroms,n_chroms,useATcorr);
     }
     if (option == OPT_PARTITION) { // partition
       HisMaker maker(out_root_file,bin,useGCcorr,genome);
+      maker.setNumThreads(n_threads);
+      maker.setAdaptiveBands(adaptiveBands,mask_tol);
+      maker.setMetrics(metrics);
       maker.partition(chroms,n_chroms,false,useATcorr,useGCcorr,range);
     }
     if (option == OPT_CALL) { // call
       HisMaker maker(out_root_file,bin,useGCcorr,genome);
+      maker.setNumThreads(n_threads);
+      maker.setMetrics(metrics);
       maker.callSVs(chroms,n_chroms,useATcorr,useGCcorr,relaxCalling);
     }
     if (option == OPT_VIEW) { // view
@@ -242,6 +377,7 @@ int main(int argc,char *argv[])
     }
     if (option == OPT_PE) { // pe
       HisMaker maker("null",genome);
+      maker.setNumThreads(n_threads);
       if (call_file.length() > 0) 
 	maker.pe_for_file(call_file,data_files,n_files,over,qual);
       else {
@@ -252,19 +388,27 @@ int main(int argc,char *argv[])
     }
     if (option == OPT_SPARTITION) { // spartition
       HisMaker maker(out_root_file,bin,useGCcorr,genome);
+      maker.setNumThreads(n_threads);
+      maker.setAdaptiveBands(adaptiveBands,mask_tol);
+      maker.setMetrics(metrics);
       maker.partition(chroms,n_chroms,true,useATcorr,useGCcorr,range);
     }
     if (option == OPT_HIS_NEW) { // his_new
       HisMaker maker(out_root_file,bin,useGCcorr,genome);
       maker.setDataDir(dir);
+      maker.setFasta(fasta);
       maker.produceHistogramsNew(chroms,n_chroms);
     }
     if (option == OPT_AGGREGATE) { // aggregate
       HisMaker maker(out_root_file,bin,useGCcorr,genome);
       maker.setDataDir(dir);
+      maker.setFasta(fasta);
       maker.aggregate(root_files,n_root_files,chroms,n_chroms);
     }
+    if (metrics) metrics->write(); // After each step, in case later ones fail
   }
+  delete metrics;
+  delete fasta;
 
   return 0;
 }
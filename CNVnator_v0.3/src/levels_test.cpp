@@ -0,0 +1,168 @@
+// C/C++ includes
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+using namespace std;
+
+// Application includes
+#include "LevelGradient.hh"
+
+// Regression test of gradient of levels (LevelGradient.cpp) against the
+// pairwise loop over bins it replaced. With libm exponent gradient must be
+// the same bit by bit, for any number of threads; with fastExp() it may
+// differ by at most TOLERANCE times sum of absolute kernel weights (bound
+// of sum of absolute terms), and must not change sign where reference is
+// larger than that. Compiled with -ffp-contract=off so that reference is
+// the loop as built without FMA.
+
+static const double TOLERANCE = 1e-12;
+
+// Gradient as calculated by HisMaker::calcLevels() before vectorization
+static void pairwiseGradient(const double *level,const bool *mask,
+			     int n_bins,int bin_band,double mean,double sigma,
+			     double *grad_b)
+{
+  for (int b = 0;b < n_bins;b++) grad_b[b] = 0;
+  double inv2_bin_band = 1./(bin_band*bin_band);
+  double mean_4 = mean/4, sigma_2 = 4/(sigma*sigma),ms2 = mean/(sigma*sigma);
+  int    win = 3*bin_band;
+  double *exps = new double[win + 1];
+  for (int i = 0;i <= win;i++)
+    exps[i] = i*exp(-0.5*i*i*inv2_bin_band);
+  for (int b = 0;b < n_bins;b++) {
+    if (mask[b]) continue;
+    double inv_b = 0; int d = 0;
+    if (level[b] < mean_4) inv_b = sigma_2;
+    else                   inv_b = ms2/level[b];
+    for (int i = b + 1;i < n_bins;i++) {
+      if (mask[i]) continue;
+      d++;
+      double inv_i = 0;
+      if (level[i] < mean_4) inv_i = sigma_2;
+      else                   inv_i = ms2/level[i];
+      double r = level[i] - level[b];
+      double val = -0.5*r*r;
+      grad_b[b] += exps[d]*exp(val*inv_b);
+      grad_b[i] -= exps[d]*exp(val*inv_i);
+      if (d == win) break;
+    }
+  }
+  delete[] exps;
+}
+
+struct Signal
+{
+  const char     *name;
+  vector<double>  level;
+  vector<char>    mask;
+};
+
+static double uniform() { return rand()/(RAND_MAX + 1.); }
+
+// Levels around mean with CNV-like steps, noise and zero bins, and mask
+// with runs of masked bins (fraction of bins in runs about masked)
+static Signal makeSignal(const char *name,int n,double mean,double masked)
+{
+  Signal s;
+  s.name = name;
+  s.level.resize(n);
+  s.mask.assign(n,0);
+  double base = mean;
+  for (int i = 0;i < n;i++) {
+    if (uniform() < 0.002) base = mean*(0.5*(rand()%4));
+    double v = base + sqrt(mean)*(uniform() + uniform() + uniform() - 1.5);
+    if (uniform() < 0.01) v = 0;
+    s.level[i] = v < 0 ? 0 : v;
+  }
+  for (int i = 0;i < n;i++)
+    if (uniform() < masked/50) {
+      int len = 1 + rand()%100;
+      for (int j = i;j < i + len && j < n;j++) s.mask[j] = 1;
+      i += len;
+    }
+  return s;
+}
+
+static int checkSignal(Signal &s,int bin_band,double mean,double sigma)
+{
+  int n = s.level.size(),failed = 0;
+  vector<double> ref(n + 1),exact(n + 1),threaded(n + 1),fast(n + 1);
+  bool *mask = new bool[n + 1];
+  for (int i = 0;i < n;i++) mask[i] = s.mask[i];
+  const double *level = n > 0 ? &s.level[0] : NULL;
+
+  pairwiseGradient(level,mask,n,bin_band,mean,sigma,&ref[0]);
+  levelGradient(level,mask,n,bin_band,mean,sigma,&exact[0],1,false);
+  levelGradient(level,mask,n,bin_band,mean,sigma,&threaded[0],4,false);
+  levelGradient(level,mask,n,bin_band,mean,sigma,&fast[0],4,true);
+
+  double bound = 0;
+  for (int i = 1;i <= 3*bin_band;i++)
+    bound += 2*i*exp(-0.5*i*i/(bin_band*bin_band));
+  bound *= TOLERANCE;
+
+  int n_exact = 0,n_threaded = 0,n_fast = 0;
+  double max_diff = 0;
+  for (int i = 0;i < n;i++) {
+    if (exact[i] != ref[i])    n_exact++;
+    if (threaded[i] != ref[i]) n_threaded++;
+    double diff = fabs(fast[i] - ref[i]);
+    if (diff > max_diff) max_diff = diff;
+    if (diff > bound ||
+	(fabs(ref[i]) > bound && (fast[i] < 0) != (ref[i] < 0))) n_fast++;
+  }
+  cout<<s.name<<", bin band "<<bin_band<<", "<<n<<" bins: ";
+  if (n_exact > 0 || n_threaded > 0) {
+    cout<<"FAILED, libm gradient differs in "<<n_exact<<" bins ("
+	<<n_threaded<<" with threads)"<<endl;
+    failed++;
+  } else if (n_fast > 0) {
+    cout<<"FAILED, fast gradient out of tolerance in "<<n_fast
+	<<" bins, max difference "<<max_diff<<endl;
+    failed++;
+  } else cout<<"ok, fast gradient max difference "<<max_diff<<endl;
+  delete[] mask;
+  return failed;
+}
+
+int main(int argc,char *argv[])
+{
+  srand(argc > 1 ? atoi(argv[1]) : 1);
+  double mean = 50,sigma = 8;
+  int failed = 0;
+
+  // Random signals of different length and masking
+  int bands[] = {2,8,32};
+  for (int b = 0;b < 3;b++) {
+    Signal plain  = makeSignal("random",20000,mean,0);
+    Signal masked = makeSignal("masked runs",20000,mean,0.3);
+    failed += checkSignal(plain,bands[b],mean,sigma);
+    failed += checkSignal(masked,bands[b],mean,sigma);
+  }
+  Signal large = makeSignal("many tiles",50000,mean,0.1);
+  failed += checkSignal(large,16,mean,sigma);
+
+  // Edge cases
+  Signal empty = makeSignal("no bins",0,mean,0);
+  Signal one   = makeSignal("one bin",1,mean,0);
+  Signal all   = makeSignal("all masked",1000,mean,0);
+  all.mask.assign(all.mask.size(),1);
+  Signal alone = makeSignal("one unmasked",1000,mean,0);
+  alone.mask.assign(alone.mask.size(),1);
+  alone.mask[500] = 0;
+  Signal flat  = makeSignal("flat",1000,mean,0);
+  flat.level.assign(flat.level.size(),mean);
+  Signal far   = makeSignal("far levels",1000,mean,0);
+  for (unsigned int i = 0;i < far.level.size();i++)
+    far.level[i] = (i%2) ? 0 : 1e4;
+  Signal *edges[] = {&empty,&one,&all,&alone,&flat,&far};
+  for (int e = 0;e < 6;e++) failed += checkSignal(*edges[e],4,mean,sigma);
+
+  if (failed > 0) {
+    cout<<failed<<" checks FAILED"<<endl;
+    return 1;
+  }
+  cout<<"All checks passed"<<endl;
+  return 0;
+}
@@ -222,6 +222,51 @@ int bam_read1(bamFile fp, bam1_t *b)
 	return 4 + block_len;
 }
 
+#ifndef BAM_LITE
+int bam_read1_core(bamFile fp, bam1_core_t *c, uint32_t *end)
+{
+	int32_t block_len, data_len, cigar_len, ret, i;
+	uint32_t x[8], buf[256], *cigar;
+
+	assert(BAM_CORE_SIZE == 32);
+	if ((ret = bam_read(fp, &block_len, 4)) != 4) {
+		if (ret == 0) return -1; // normal end-of-file
+		else return -2; // truncated
+	}
+	if (bam_read(fp, x, BAM_CORE_SIZE) != BAM_CORE_SIZE) return -3;
+	if (bam_is_be) {
+		bam_swap_endian_4p(&block_len);
+		for (i = 0; i < 8; ++i) bam_swap_endian_4p(x + i);
+	}
+	c->tid = x[0]; c->pos = x[1];
+	c->bin = x[2]>>16; c->qual = x[2]>>8&0xff; c->l_qname = x[2]&0xff;
+	c->flag = x[3]>>16; c->n_cigar = x[3]&0xffff;
+	c->l_qseq = x[4];
+	c->mtid = x[5]; c->mpos = x[6]; c->isize = x[7];
+	data_len = block_len - BAM_CORE_SIZE;
+	cigar_len = c->n_cigar * 4;
+	if (data_len < c->l_qname + cigar_len) return -4;
+	if (!bam_is_be && fp->block_length - fp->block_offset >= c->l_qname + cigar_len) {
+		// CIGAR is in the decompressed block; use it in place
+		cigar = (uint32_t*)((uint8_t*)fp->uncompressed_block + fp->block_offset + c->l_qname);
+		*end = bam_calend(c, cigar);
+	} else { // CIGAR crosses the block boundary
+		cigar = c->n_cigar <= 256? buf : (uint32_t*)malloc(cigar_len);
+		ret = bam_skip(fp, c->l_qname) == c->l_qname && bam_read(fp, cigar, cigar_len) == cigar_len;
+		if (ret) {
+			if (bam_is_be)
+				for (i = 0; i < c->n_cigar; ++i) bam_swap_endian_4p(cigar + i);
+			*end = bam_calend(c, cigar);
+		}
+		if (cigar != buf) free(cigar);
+		if (!ret) return -4;
+		data_len -= c->l_qname + cigar_len;
+	}
+	if (bam_skip(fp, data_len) != data_len) return -4;
+	return 4 + block_len;
+}
+#endif
+
 inline int bam_write1_core(bamFile fp, const bam1_core_t *c, int data_len, uint8_t *data)
 {
 	uint32_t x[8], block_len = data_len + BAM_CORE_SIZE, y;
@@ -56,6 +56,7 @@ typedef BGZF *bamFile;
 #define bam_dopen(fd, mode) bgzf_fdopen(fd, mode)
 #define bam_close(fp) bgzf_close(fp)
 #define bam_read(fp, buf, size) bgzf_read(fp, buf, size)
+#define bam_skip(fp, size) bgzf_skip(fp, size)
 #define bam_write(fp, buf, size) bgzf_write(fp, buf, size)
 #define bam_tell(fp) bgzf_tell(fp)
 #define bam_seek(fp, pos, dir) bgzf_seek(fp, pos, dir)
@@ -436,6 +437,22 @@ extern "C" {
 	 */
 	int bam_read1(bamFile fp, bam1_t *b);
 
+#ifndef BAM_LITE
+	/*!
+	  @abstract   Read the core of an alignment from BAM.
+	  @param  fp  BAM file handler
+	  @param  c   alignment core; all members are updated.
+	  @param  end end of the alignment computed by bam_calend()
+	  @return     number of bytes read from the file
+
+	  @discussion Same as bam_read1() but read name, sequence,
+	  quality and auxiliary data are skipped without being copied
+	  out. CIGAR is used in place if it lies in the decompressed
+	  block and is not kept.
+	 */
+	int bam_read1_core(bamFile fp, bam1_core_t *c, uint32_t *end);
+#endif
+
 	int bam_remove_B(bam1_t *b);
 
 	/*!
@@ -645,6 +662,7 @@ extern "C" {
 
 	bam_iter_t bam_iter_query(const bam_index_t *idx, int tid, int beg, int end);
 	int bam_iter_read(bamFile fp, bam_iter_t iter, bam1_t *b);
+	int bam_iter_read_core(bamFile fp, bam_iter_t iter, bam1_core_t *c, uint32_t *end);
 	void bam_iter_destroy(bam_iter_t iter);
 
 	/*!
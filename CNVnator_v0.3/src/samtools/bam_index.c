@@ -712,6 +712,41 @@ int bam_iter_read(bamFile fp, bam_iter_t iter, bam1_t *b)
 	return ret;
 }
 
+// Same as bam_iter_read() but with bam_read1_core()
+int bam_iter_read_core(bamFile fp, bam_iter_t iter, bam1_core_t *c, uint32_t *end)
+{
+	int ret;
+	if (iter && iter->finished) return -1;
+	if (iter == 0 || iter->from_first) {
+		ret = bam_read1_core(fp, c, end);
+		if (ret < 0 && iter) iter->finished = 1;
+		return ret;
+	}
+	if (iter->off == 0) return -1;
+	for (;;) {
+		if (iter->curr_off == 0 || iter->curr_off >= iter->off[iter->i].v) { // then jump to the next chunk
+			if (iter->i == iter->n_off - 1) { ret = -1; break; } // no more chunks
+			if (iter->i >= 0) assert(iter->curr_off == iter->off[iter->i].v); // otherwise bug
+			if (iter->i < 0 || iter->off[iter->i].v != iter->off[iter->i+1].u) { // not adjacent chunks; then seek
+				bam_seek(fp, iter->off[iter->i+1].u, SEEK_SET);
+				iter->curr_off = bam_tell(fp);
+			}
+			++iter->i;
+		}
+		if ((ret = bam_read1_core(fp, c, end)) >= 0) {
+			uint32_t rend = c->n_cigar? *end : c->pos + 1;
+			iter->curr_off = bam_tell(fp);
+			if (c->tid != iter->tid || c->pos >= iter->end) { // no need to proceed
+				ret = (c->tid < -1 || c->mtid < -1)? -5 : -1; // determine whether end of region or error
+				break;
+			}
+			else if (rend > iter->beg && c->pos < iter->end) return ret;
+		} else break; // end of file or error
+	}
+	iter->finished = 1;
+	return ret;
+}
+
 int bam_fetch(bamFile fp, const bam_index_t *idx, int tid, int beg, int end, void *data, bam_fetch_f func)
 {
 	int ret;
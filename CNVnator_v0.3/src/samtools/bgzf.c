@@ -210,33 +210,33 @@ static int deflate_block(BGZF *fp, int block_length)
 	return comp_size;
 }
 
-// Inflate the block in fp->compressed_block into fp->uncompressed_block
-static int inflate_block(BGZF* fp, int block_length)
+static int bgzf_uncompress(void *dst, void *src, int block_length)
 {
 	z_stream zs;
 	zs.zalloc = NULL;
 	zs.zfree = NULL;
-	zs.next_in = fp->compressed_block + 18;
+	zs.next_in = (uint8_t*)src + 18;
 	zs.avail_in = block_length - 16;
-	zs.next_out = fp->uncompressed_block;
+	zs.next_out = dst;
 	zs.avail_out = BGZF_MAX_BLOCK_SIZE;
 
-	if (inflateInit2(&zs, -15) != Z_OK) {
-		fp->errcode |= BGZF_ERR_ZLIB;
-		return -1;
-	}
+	if (inflateInit2(&zs, -15) != Z_OK) return -1;
 	if (inflate(&zs, Z_FINISH) != Z_STREAM_END) {
 		inflateEnd(&zs);
-		fp->errcode |= BGZF_ERR_ZLIB;
-		return -1;
-	}
-	if (inflateEnd(&zs) != Z_OK) {
-		fp->errcode |= BGZF_ERR_ZLIB;
 		return -1;
 	}
+	if (inflateEnd(&zs) != Z_OK) return -1;
 	return zs.total_out;
 }
 
+// Inflate the block in fp->compressed_block into fp->uncompressed_block
+static int inflate_block(BGZF* fp, int block_length)
+{
+	int ret = bgzf_uncompress(fp->uncompressed_block, fp->compressed_block, block_length);
+	if (ret < 0) fp->errcode |= BGZF_ERR_ZLIB;
+	return ret;
+}
+
 static int check_header(const uint8_t *header)
 {
 	return (header[0] == 31 && header[1] == 139 && header[2] == 8 && (header[3] & 4) != 0
@@ -304,11 +304,205 @@ static int load_block_from_cache(BGZF *fp, int64_t block_address) {return 0;}
 static void cache_block(BGZF *fp, int size) {}
 #endif
 
+/***** BEGIN: multi-threaded reading *****/
+
+/* The reading thread loads compressed blocks following the current one
+ * into a ring of slots, and worker threads inflate them in the background.
+ * Blocks are handed over to the reader in the file order. */
+
+enum { RSLOT_EMPTY, RSLOT_QUEUED, RSLOT_BUSY, RSLOT_DONE };
+
+typedef struct {
+	int64_t address; // file offset of the compressed block
+	int size;        // compressed size
+	int length;      // inflated size; -1 on error
+	int state, errcode;
+	void *cblock, *ublock;
+} rslot_t;
+
+typedef struct {
+	int n_threads, n_slots, head, n_used, ahead, eof, done;
+	int64_t next_address; // file offset following the current block
+	rslot_t *slots;
+	pthread_t *tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cv;
+} mtread_t;
+
+static void *mt_read_worker(void *data)
+{
+	mtread_t *mt = (mtread_t*)data;
+	rslot_t *s;
+	int i, k;
+	pthread_mutex_lock(&mt->lock);
+	while (!mt->done) {
+		for (i = 0, k = -1; i < mt->n_used; ++i) { // the oldest block first
+			k = (mt->head + i) % mt->n_slots;
+			if (mt->slots[k].state == RSLOT_QUEUED) break;
+		}
+		if (i == mt->n_used) {
+			pthread_cond_wait(&mt->cv, &mt->lock);
+			continue;
+		}
+		s = &mt->slots[k];
+		s->state = RSLOT_BUSY;
+		pthread_mutex_unlock(&mt->lock);
+		s->length = bgzf_uncompress(s->ublock, s->cblock, s->size);
+		pthread_mutex_lock(&mt->lock);
+		s->state = RSLOT_DONE;
+		pthread_cond_broadcast(&mt->cv);
+	}
+	pthread_mutex_unlock(&mt->lock);
+	return 0;
+}
+
+static int mt_read_init(BGZF *fp, int n_threads, int n_sub_blks)
+{
+	int i;
+	mtread_t *mt;
+	if (fp->mt || n_threads <= 1 || n_sub_blks < 1) return -1;
+	mt = calloc(1, sizeof(mtread_t));
+	mt->n_threads = n_threads;
+	mt->n_slots = n_threads * n_sub_blks;
+	mt->ahead = n_threads;
+	mt->next_address = _bgzf_tell((_bgzf_file_t)fp->fp);
+	mt->slots = calloc(mt->n_slots, sizeof(rslot_t));
+	for (i = 0; i < mt->n_slots; ++i) {
+		mt->slots[i].cblock = malloc(BGZF_MAX_BLOCK_SIZE);
+		mt->slots[i].ublock = malloc(BGZF_MAX_BLOCK_SIZE);
+	}
+	mt->tid = calloc(mt->n_threads, sizeof(pthread_t));
+	pthread_mutex_init(&mt->lock, 0);
+	pthread_cond_init(&mt->cv, 0);
+	for (i = 0; i < mt->n_threads; ++i) // the reader only does I/O
+		pthread_create(&mt->tid[i], 0, mt_read_worker, mt);
+	fp->mt = mt;
+	return 0;
+}
+
+static void mt_read_destroy(mtread_t *mt)
+{
+	int i;
+	pthread_mutex_lock(&mt->lock);
+	mt->done = 1;
+	pthread_cond_broadcast(&mt->cv);
+	pthread_mutex_unlock(&mt->lock);
+	for (i = 0; i < mt->n_threads; ++i) pthread_join(mt->tid[i], 0);
+	for (i = 0; i < mt->n_slots; ++i) {
+		free(mt->slots[i].cblock);
+		free(mt->slots[i].ublock);
+	}
+	free(mt->slots); free(mt->tid);
+	pthread_cond_destroy(&mt->cv);
+	pthread_mutex_destroy(&mt->lock);
+	free(mt);
+}
+
+// Load compressed blocks into free slots; the window grows after each seek
+static void mt_read_fill(BGZF *fp)
+{
+	mtread_t *mt = (mtread_t*)fp->mt;
+	uint8_t header[BLOCK_HEADER_LENGTH];
+	rslot_t *s;
+	int count, remaining;
+	while (!mt->eof && mt->n_used < mt->ahead) {
+		s = &mt->slots[(mt->head + mt->n_used) % mt->n_slots];
+		s->address = _bgzf_tell((_bgzf_file_t)fp->fp);
+		s->size = s->length = s->errcode = 0;
+		count = _bgzf_read(fp->fp, header, sizeof(header));
+		if (count == 0) { // end of file
+			mt->eof = 1;
+			break;
+		}
+		if (count != sizeof(header) || !check_header(header)) s->errcode = BGZF_ERR_HEADER;
+		else {
+			s->size = unpackInt16((uint8_t*)&header[16]) + 1;
+			memcpy(s->cblock, header, BLOCK_HEADER_LENGTH);
+			remaining = s->size - BLOCK_HEADER_LENGTH;
+			count = _bgzf_read(fp->fp, (uint8_t*)s->cblock + BLOCK_HEADER_LENGTH, remaining);
+			if (count != remaining) s->errcode = BGZF_ERR_IO;
+		}
+		if (s->errcode) mt->eof = 1; // report the error when this block is reached
+		pthread_mutex_lock(&mt->lock);
+		s->state = s->errcode? RSLOT_DONE : RSLOT_QUEUED;
+		++mt->n_used;
+		pthread_cond_broadcast(&mt->cv);
+		pthread_mutex_unlock(&mt->lock);
+	}
+}
+
+static int mt_read_block(BGZF *fp)
+{
+	mtread_t *mt = (mtread_t*)fp->mt;
+	rslot_t *s;
+	mt_read_fill(fp);
+	if (mt->n_used == 0) { // no data read
+		fp->block_length = 0;
+		return 0;
+	}
+	s = &mt->slots[mt->head];
+	pthread_mutex_lock(&mt->lock);
+	while (s->state != RSLOT_DONE)
+		pthread_cond_wait(&mt->cv, &mt->lock);
+	pthread_mutex_unlock(&mt->lock);
+	if (s->errcode || s->length < 0) {
+		fp->errcode |= s->errcode? s->errcode : BGZF_ERR_ZLIB;
+		return -1;
+	}
+	memcpy(fp->uncompressed_block, s->ublock, s->length);
+	if (fp->block_length != 0) fp->block_offset = 0; // Do not reset offset if this read follows a seek.
+	fp->block_address = s->address;
+	fp->block_length = s->length;
+	mt->next_address = s->address + s->size;
+	pthread_mutex_lock(&mt->lock);
+	s->state = RSLOT_EMPTY;
+	mt->head = (mt->head + 1) % mt->n_slots;
+	--mt->n_used;
+	pthread_mutex_unlock(&mt->lock);
+	if (mt->ahead < mt->n_slots) ++mt->ahead;
+	return 0;
+}
+
+// Drop blocks loaded before the one at _address_, or all if it is not loaded; return 1 if found
+static int mt_read_seek(mtread_t *mt, int64_t address)
+{
+	int i, k, found, busy;
+	pthread_mutex_lock(&mt->lock);
+	for (k = 0; k < mt->n_used; ++k)
+		if (mt->slots[(mt->head + k) % mt->n_slots].address == address) break;
+	found = k < mt->n_used;
+	do { // blocks being inflated can't be dropped
+		for (i = 0, busy = 0; i < k; ++i)
+			if (mt->slots[(mt->head + i) % mt->n_slots].state == RSLOT_BUSY) busy = 1;
+		if (busy) pthread_cond_wait(&mt->cv, &mt->lock);
+	} while (busy);
+	for (i = 0; i < k; ++i) mt->slots[(mt->head + i) % mt->n_slots].state = RSLOT_EMPTY;
+	mt->head = (mt->head + k) % mt->n_slots;
+	mt->n_used -= k;
+	if (!found) {
+		mt->eof = 0;
+		mt->ahead = mt->n_threads;
+		mt->next_address = address;
+	}
+	pthread_mutex_unlock(&mt->lock);
+	return found;
+}
+
+/***** END: multi-threaded reading *****/
+
+// File offset following the current block
+static inline int64_t bgzf_htell(BGZF *fp)
+{
+	if (!fp->is_write && fp->mt) return ((mtread_t*)fp->mt)->next_address;
+	return _bgzf_tell((_bgzf_file_t)fp->fp);
+}
+
 int bgzf_read_block(BGZF *fp)
 {
 	uint8_t header[BLOCK_HEADER_LENGTH], *compressed_block;
 	int count, size = 0, block_length, remaining;
 	int64_t block_address;
+	if (fp->mt) return mt_read_block(fp);
 	block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
 	if (fp->cache_size && load_block_from_cache(fp, block_address)) return 0;
 	count = _bgzf_read(fp->fp, header, sizeof(header));
@@ -361,12 +555,35 @@ ssize_t bgzf_read(BGZF *fp, void *data, ssize_t length)
 		bytes_read += copy_length;
 	}
 	if (fp->block_offset == fp->block_length) {
-		fp->block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
+		fp->block_address = bgzf_htell(fp);
 		fp->block_offset = fp->block_length = 0;
 	}
 	return bytes_read;
 }
 
+ssize_t bgzf_skip(BGZF *fp, ssize_t length)
+{
+	ssize_t bytes_skipped = 0;
+	if (length <= 0) return 0;
+	assert(fp->is_write == 0);
+	while (bytes_skipped < length) {
+		int skip_length, available = fp->block_length - fp->block_offset;
+		if (available <= 0) {
+			if (bgzf_read_block(fp) != 0) return -1;
+			available = fp->block_length - fp->block_offset;
+			if (available <= 0) break;
+		}
+		skip_length = length - bytes_skipped < available? length - bytes_skipped : available;
+		fp->block_offset += skip_length;
+		bytes_skipped += skip_length;
+	}
+	if (fp->block_offset == fp->block_length) {
+		fp->block_address = bgzf_htell(fp);
+		fp->block_offset = fp->block_length = 0;
+	}
+	return bytes_skipped;
+}
+
 /***** BEGIN: multi-threading *****/
 
 typedef struct {
@@ -421,7 +638,8 @@ int bgzf_mt(BGZF *fp, int n_threads, int n_sub_blks)
 	int i;
 	mtaux_t *mt;
 	pthread_attr_t attr;
-	if (!fp->is_write || fp->mt || n_threads <= 1) return -1;
+	if (!fp->is_write) return mt_read_init(fp, n_threads, n_sub_blks);
+	if (fp->mt || n_threads <= 1) return -1;
 	mt = calloc(1, sizeof(mtaux_t));
 	mt->n_threads = n_threads;
 	mt->n_blks = n_threads * n_sub_blks;
@@ -581,7 +799,7 @@ int bgzf_close(BGZF* fp)
 			return -1;
 		}
 		if (fp->mt) mt_destroy(fp->mt);
-	}
+	} else if (fp->mt) mt_read_destroy(fp->mt);
 	ret = fp->is_write? fclose(fp->fp) : _bgzf_close(fp->fp);
 	if (ret != 0) return -1;
 	free(fp->uncompressed_block);
@@ -619,7 +837,8 @@ int64_t bgzf_seek(BGZF* fp, int64_t pos, int where)
 	}
 	block_offset = pos & 0xFFFF;
 	block_address = pos >> 16;
-	if (_bgzf_seek(fp->fp, block_address, SEEK_SET) < 0) {
+	if ((!fp->mt || !mt_read_seek(fp->mt, block_address))
+		&& _bgzf_seek(fp->fp, block_address, SEEK_SET) < 0) {
 		fp->errcode |= BGZF_ERR_IO;
 		return -1;
 	}
@@ -650,7 +869,7 @@ int bgzf_getc(BGZF *fp)
 	}
 	c = ((unsigned char*)fp->uncompressed_block)[fp->block_offset++];
     if (fp->block_offset == fp->block_length) {
-        fp->block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
+        fp->block_address = bgzf_htell(fp);
         fp->block_offset = 0;
         fp->block_length = 0;
     }
@@ -683,7 +902,7 @@ int bgzf_getline(BGZF *fp, int delim, kstring_t *str)
 		str->l += l;
 		fp->block_offset += l + 1;
 		if (fp->block_offset >= fp->block_length) {
-			fp->block_address = _bgzf_tell((_bgzf_file_t)fp->fp);
+			fp->block_address = bgzf_htell(fp);
 			fp->block_offset = 0;
 			fp->block_length = 0;
 		} 
@@ -103,6 +103,15 @@ extern "C" {
 	 */
 	ssize_t bgzf_read(BGZF *fp, void *data, ssize_t length);
 
+	/**
+	 * Skip up to _length_ bytes without copying them out.
+	 *
+	 * @param fp     BGZF file handler
+	 * @param length number of bytes to skip
+	 * @return       number of bytes actually skipped; 0 on end-of-file and -1 on error
+	 */
+	ssize_t bgzf_skip(BGZF *fp, ssize_t length);
+
 	/**
 	 * Write _length_ bytes from _data_ to the file.
 	 *
@@ -192,11 +201,13 @@ extern "C" {
 	int bgzf_read_block(BGZF *fp);
 
 	/**
-	 * Enable multi-threading (only effective on writing)
+	 * Enable multi-threading. On writing, blocks are compressed in batches;
+	 * on reading, blocks following the current one are inflated ahead.
 	 *
-	 * @param fp          BGZF file handler; must be opened for writing
-	 * @param n_threads   #threads used for writing
+	 * @param fp          BGZF file handler
+	 * @param n_threads   #threads used for compressing/inflating
 	 * @param n_sub_blks  #blocks processed by each thread; a value 64-256 is recommended
+	 *                    on writing and 4-16 on reading
 	 */
 	int bgzf_mt(BGZF *fp, int n_threads, int n_sub_blks);
 